@@ -14,6 +14,10 @@ int main(int argc, char* argv[]) {
       uci::bench();
       return EXIT_SUCCESS;
     }
+    if(std::string(argv[1]) == "perftbench"){
+      uci::perftBench();
+      return EXIT_SUCCESS;
+    }
   }
 
   chess::Board board;
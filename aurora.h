@@ -12,6 +12,10 @@
 #else
 #define DEV_STRING ""
 #endif
+//CONSTEXPR_SEARCH_PARAMS bakes the tuned search parameters into the build, so they can't be changed with setoption (see search::SearchParams)
+#if defined(CONSTEXPR_SEARCH_PARAMS) && defined(DEV)
+#error "dev builds have to keep the search parameters tunable, don't define CONSTEXPR_SEARCH_PARAMS for them"
+#endif
 #ifdef GIT_HASH
 #define GIT_HASH_STRING GIT_HASH
 #else
@@ -50,9 +54,12 @@ struct Option{
     }
 };
 
-inline Option hash("Hash", 16, 0, 65536, 1);
-inline Option ttHash("TTHash", 0, 0, 65536, 1);
+//Hash and TTHash are in mb, up to 4 tb (values stay exact in a float up to 2^24)
+inline Option hash("Hash", 16, 0, 4194304, 1);
+inline Option ttHash("TTHash", 0, 0, 4194304, 1);
 inline Option threads("Threads", 1, 1, 1, 1); // just here to make OpenBench happy
+inline Option qSearchTTHash("QSearchTTHash", 1, 0, 1024, 1); // size in mb of the table qSearch uses for its interior nodes, 0 disables it
+inline Option expansionCacheHash("ExpansionCacheHash", 0, 0, 1024, 1); // size in mb of the cache of LRU pruned nodes' child values (see search::ExpansionCache), 0 disables it
 
 inline Option syzygyPath("SyzygyPath", "<empty>", 2);
 
@@ -63,30 +70,66 @@ inline Option outputLevel("outputLevel", 2, -1, 3, 1);
 //  2: output bestmove and info at end of search and output info every 2 seconds
 //  3: output bestmove and info at end of search and output info + verbose move stats every 2 seconds
 
+inline Option lazyExpansion("LazyExpansion", 0, 0, 256, 1);
+// 0: every child of an expanded node gets a full playout (qSearch)
+// K: only the K children with the best static eval do, the rest are filled in when they are first selected
+
+inline Option graphSearch("GraphSearch", 0, 0, 1, 1);
+// 0: every path to a position gets its own node
+// 1: transpositions share one node, along with its stats and subtree (see search::Tree::nodeMap)
+
+inline Option ttWarmStart("TTWarmStart", 0, 0, 1, 1);
+// 0: a node created for a position the tree had before (e.g. after LRU pruning) starts from its edge's value alone
+// 1: it also takes its iterations from the TT's visit count, and with lazy expansion the child the TT has as its best gets a playout
+
 inline Option timeManager("timeManager", 0, 0, 3, 1);
 // 0: normal time management
 // 1: basic time management based on time left and increment only
 // 2: normal time management with nodestime
 // 3: basic time management with nodestime based on time left and increment only
 
-inline Option rootExplorationFactor("rootExplorationFactor", 0.026254, 0.001, 1024, 0, true);
-inline Option explorationFactor("explorationFactor", 0.013573, 0.001, 1024, 0, true);
-inline Option valChangedMinWeight("valChangedMinWeight", 0.13744, 0.001, 1024, 0, true);
-inline Option valSameMinWeight("valSameMinWeight", 0.012934, 0.001, 1024, 0, true);
+//Defaults of the tuned search parameters, as constants so a build with CONSTEXPR_SEARCH_PARAMS can fold them into the search (see search::SearchParams)
+namespace tuned{
+inline constexpr float rootExplorationFactor = 0.026254;
+inline constexpr float explorationFactor = 0.013573;
+inline constexpr float valChangedMinWeight = 0.13744;
+inline constexpr float valSameMinWeight = 0.012934;
+inline constexpr float varianceScaleMultiplier = 15.262608;
+inline constexpr float varianceScaleOffset = 0.006116;
+inline constexpr float varianceScaleMin = 0.974996;
+inline constexpr float varianceScaleMax = 1.92726;
+inline constexpr float visitWindow = 0.037702;
+inline constexpr float visitBoostMultiplier = 1.0;
+inline constexpr float visitBoostOffset = 0.0004;
+inline constexpr float bestMoveChangesCoefficient = 0.233217;
+inline constexpr float bestMoveChangesExponent = 0.587161;
+inline constexpr float bestMoveChangesMultiplierMin = 0.241893;
+inline constexpr float bestMoveChangesMultiplierMax = 2.053642;
+inline constexpr int qSearchDeltaMargin = 200;
+inline constexpr int qSearchMaxDepth = 0;
+}
+
+inline Option rootExplorationFactor("rootExplorationFactor", tuned::rootExplorationFactor, 0.001, 1024, 0, true);
+inline Option explorationFactor("explorationFactor", tuned::explorationFactor, 0.001, 1024, 0, true);
+inline Option valChangedMinWeight("valChangedMinWeight", tuned::valChangedMinWeight, 0.001, 1024, 0, true);
+inline Option valSameMinWeight("valSameMinWeight", tuned::valSameMinWeight, 0.001, 1024, 0, true);
+
+inline Option varianceScaleMultiplier("varianceScaleMultiplier", tuned::varianceScaleMultiplier, 0, 1024, 0, true);
+inline Option varianceScaleOffset("varianceScaleOffset", tuned::varianceScaleOffset, -1, 1, 0, true);
+inline Option varianceScaleMin("varianceScaleMin", tuned::varianceScaleMin, 0, 1024, 0, true);
+inline Option varianceScaleMax("varianceScaleMax", tuned::varianceScaleMax, 0, 1024, 0, true);
 
-inline Option varianceScaleMultiplier("varianceScaleMultiplier", 15.262608, 0, 1024, 0, true);
-inline Option varianceScaleOffset("varianceScaleOffset", 0.006116, -1, 1, 0, true);
-inline Option varianceScaleMin("varianceScaleMin", 0.974996, 0, 1024, 0, true);
-inline Option varianceScaleMax("varianceScaleMax", 1.92726, 0, 1024, 0, true);
+inline Option visitWindow("visitWindow", tuned::visitWindow, 0, 10, 0, true);
 
-inline Option visitWindow("visitWindow", 0.037702, 0, 10, 0, true);
+inline Option visitBoostMultiplier("visitBoostMultiplier", tuned::visitBoostMultiplier, 0, 10, 0, true);
+inline Option visitBoostOffset("visitBoostOffset", tuned::visitBoostOffset, 0, 1, 0, true);
+inline Option bestMoveChangesCoefficient("bestMoveChangesCoefficient", tuned::bestMoveChangesCoefficient, 0, 1024, 0, true);
+inline Option bestMoveChangesExponent("bestMoveChangesExponent", tuned::bestMoveChangesExponent, 0, 16, 0, true);
+inline Option bestMoveChangesMultiplierMin("bestMoveChangesMultiplierMin", tuned::bestMoveChangesMultiplierMin, 0, 1024, 0, true);
+inline Option bestMoveChangesMultiplierMax("bestMoveChangesMultiplierMax", tuned::bestMoveChangesMultiplierMax, 0, 1024, 0, true);
 
-inline Option visitBoostMultiplier("visitBoostMultiplier", 1.0, 0, 10, 0, true);
-inline Option visitBoostOffset("visitBoostOffset", 0.0004, 0, 1, 0, true);
-inline Option bestMoveChangesCoefficient("bestMoveChangesCoefficient", 0.233217, 0, 1024, 0, true);
-inline Option bestMoveChangesExponent("bestMoveChangesExponent", 0.587161, 0, 16, 0, true);
-inline Option bestMoveChangesMultiplierMin("bestMoveChangesMultiplierMin", 0.241893, 0, 1024, 0, true);
-inline Option bestMoveChangesMultiplierMax("bestMoveChangesMultiplierMax", 2.053642, 0, 1024, 0, true);
+inline Option qSearchDeltaMargin("qSearchDeltaMargin", tuned::qSearchDeltaMargin, 0, 100000, 1, true); // set to the max to effectively turn off delta pruning
+inline Option qSearchMaxDepth("qSearchMaxDepth", tuned::qSearchMaxDepth, 0, 128, 1, true); // 0 means no limit
 
 inline Option timeManagementMovesLeft("timeManagementMovesLeft", 30, 1, 200, 1, true);
 inline Option timeManagementSoftFraction("timeManagementSoftFraction", 0.051142, 0, 1, 0, true);
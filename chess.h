@@ -19,6 +19,36 @@ struct KingMasks{
   U64 rookPinnedPieces = 0ULL;
   U64 bishopPinmask = 0ULL;
   U64 bishopPinnedPieces = 0ULL;
+  U64 checkers = 0ULL; //their pieces which are giving check
+  U64 kingDanger = 0ULL; //squares attacked by their pieces, with our king removed so it does not block attacks on squares behind it
+};
+
+//Shifts a bitboard one rank forward from color's point of view
+template<Colors color>
+constexpr U64 pawnPush(U64 bitboard){
+  if constexpr(color == WHITE){return bitboard << 8;}
+  else{return bitboard >> 8;}
+}
+
+//Everything needed to undo a move with Board::unmakeMove() which can't be recovered from the move itself
+struct UndoInfo{
+  U64 enPassant;
+  U64 hash;
+  int halfmoveClock;
+  unsigned char castlingRights;
+  uint8_t startHistoryIndex;
+  uint8_t capturedPiece; //mailbox value (from white's perspective) of the captured piece, 0 if nothing was captured or the move is en passant
+};
+
+//Zobrist hashes of all positions reached so far, one per ply, with the current position on top. Used to check for repetitions
+//This is kept outside of Board so that Boards stay small; the search shares one History which chess::makeMove() pushes to and chess::unmakeMove() pops from
+struct History{
+  std::vector<U64> hashes;
+
+  void push(U64 hash){hashes.push_back(hash);}
+  void pop(){hashes.pop_back();}
+  void clear(){hashes.clear();}
+  size_t size() const{return hashes.size();}
 };
 
 struct Board{
@@ -36,11 +66,13 @@ struct Board{
   U64 occupied;
   Colors sideToMove = WHITE; unsigned char castlingRights; U64 enPassant; int halfmoveClock;
 
-  unsigned char canCurrentlyCastle = 0;
+  //checkmasks, pinmasks, etc. are cached here by getKingMasks() so that every move generator called on the same position shares them
+  KingMasks kingMasks;
+  bool kingMasksValid = false;
 
-  //use to check for repetitions
-  U64 history[128] = {};
-  bool hashed = false; //if there is a zobrist hash of the position in history, this is true
+  //zobrist hash of the position, only valid if hashed is true
+  U64 hash = 0ULL;
+  bool hashed = false; //if hash is valid and the position is on top of the History used with this board, this is true
   uint8_t startHistoryIndex = 0; //When a fen is entered, we want getGameStatus to ignore all items of history before the halfmoveClock of the fen
 
   std::array<std::array<uint8_t, 64>, 2> mailbox{}; //mailbox representation of the board, one for each side
@@ -101,23 +133,13 @@ struct Board{
     );
   }
 
-  bool equivalentHistory(const Board& board){
-    if(!hashed || !board.hashed){return false;}
-    if(startHistoryIndex != board.startHistoryIndex){return false;}
-    if(halfmoveClock != board.halfmoveClock){return false;}
-
-    for(int i=startHistoryIndex; i<=halfmoveClock; i++){
-      if(history[i] != board.history[i]){return false;}
-    }
-    return true;
-  }
-
   void setToFen(const std::string& fenString) {
     std::istringstream fenStream(fenString);
     std::string token;
 
     for(int i=0; i<64; i++){mailbox[0][i] = 0; mailbox[1][i] = 0;}
     hashed = false;
+    kingMasksValid = false;
 
     pawns=0ULL;
     knights=0ULL;
@@ -412,17 +434,18 @@ struct Board{
     }
   }
 
-  //generates checkmasks and pinmasks
+  //generates checkmasks, pinmasks, checkers and the king danger squares. Use getKingMasks() to get them cached
+  template<Colors us>
   KingMasks generateKingMasks() const{
-    U64 ourPieces = getOurPieces();
+    U64 ourPieces = getPieces(us);
     uint8_t square = bitscanForward(ourPieces & kings);
-    U64 theirPieces = getTheirPieces();
+    U64 theirPieces = getPieces(Colors(!us));
     KingMasks _kingMasks;
 
     int numAttackers = 0;
 
     int squareRank = squareIndexToRank(square); int squareFile = squareIndexToFile(square);
-    if(lookupTables::knightTable[square] & knights & theirPieces){_kingMasks.checkmask |= lookupTables::knightTable[square] & knights & theirPieces; numAttackers++;}
+    if(lookupTables::knightTable[square] & knights & theirPieces){_kingMasks.checkmask |= lookupTables::knightTable[square] & knights & theirPieces; _kingMasks.checkers |= lookupTables::knightTable[square] & knights & theirPieces; numAttackers++;}
 
     U64 rookAttacks = lookupTables::getRookAttacks(square, theirPieces) & (rooks | queens) & theirPieces;
     U64 attackRay = 0ULL;
@@ -437,7 +460,7 @@ struct Board{
         if(theirRookRank>squareRank){attackRay = rays::rays[0][square] & ~rays::rays[0][theirRook];}
         else{attackRay = rays::rays[1][square] & ~rays::rays[1][theirRook];}
       }
-      if(!(attackRay & ourPieces)){_kingMasks.checkmask |= attackRay; numAttackers++;}
+      if(!(attackRay & ourPieces)){_kingMasks.checkmask |= attackRay; _kingMasks.checkers |= 1ULL << theirRook; numAttackers++;}
       else if(popCount(attackRay & ourPieces) == 1){_kingMasks.rookPinmask |= attackRay; _kingMasks.rookPinnedPieces |= attackRay & ourPieces;}
     }
 
@@ -453,15 +476,48 @@ struct Board{
         if(theirBishopFile<squareFile){attackRay = rays::rays[6][square] & ~rays::rays[6][theirBishop];}
         else{attackRay = rays::rays[7][square] & ~rays::rays[7][theirBishop];}
       }
-      if(!(attackRay & ourPieces)){_kingMasks.checkmask |= attackRay; numAttackers++;}
+      if(!(attackRay & ourPieces)){_kingMasks.checkmask |= attackRay; _kingMasks.checkers |= 1ULL << theirBishop; numAttackers++;}
       else if(popCount(attackRay & ourPieces) == 1){_kingMasks.bishopPinmask |= attackRay; _kingMasks.bishopPinnedPieces |= attackRay & ourPieces;}
     }
-    if(lookupTables::pawnAttackTable[sideToMove][square] & pawns & theirPieces){_kingMasks.checkmask |= lookupTables::pawnAttackTable[sideToMove][square] & pawns & theirPieces; numAttackers++;}
+    if(lookupTables::pawnAttackTable[us][square] & pawns & theirPieces){_kingMasks.checkmask |= lookupTables::pawnAttackTable[us][square] & pawns & theirPieces; _kingMasks.checkers |= lookupTables::pawnAttackTable[us][square] & pawns & theirPieces; numAttackers++;}
     
     if(numAttackers>1){_kingMasks.checkmask = 0ULL;}
     if(numAttackers==0){_kingMasks.checkmask = 0xFFFFFFFFFFFFFFFFULL;}
+
+    //king danger squares
+    U64 occupiedWithoutKing = occupied & ~(1ULL << square);
+    U64 theirPawns = pawns & theirPieces;
+    if constexpr(us == WHITE){_kingMasks.kingDanger = ((theirPawns >> 9) & ~bitboards::fileH) | ((theirPawns >> 7) & ~bitboards::fileA);}
+    else{_kingMasks.kingDanger = ((theirPawns << 9) & ~bitboards::fileA) | ((theirPawns << 7) & ~bitboards::fileH);}
+
+    U64 pieceBitboard = knights & theirPieces;
+    while(pieceBitboard){_kingMasks.kingDanger |= lookupTables::knightTable[popLsb(pieceBitboard)];}
+    pieceBitboard = (bishops | queens) & theirPieces;
+    while(pieceBitboard){_kingMasks.kingDanger |= lookupTables::getBishopAttacks(popLsb(pieceBitboard), occupiedWithoutKing);}
+    pieceBitboard = (rooks | queens) & theirPieces;
+    while(pieceBitboard){_kingMasks.kingDanger |= lookupTables::getRookAttacks(popLsb(pieceBitboard), occupiedWithoutKing);}
+    _kingMasks.kingDanger |= lookupTables::kingTable[bitscanForward(kings & theirPieces)];
+
     return _kingMasks;
   }
+
+  KingMasks generateKingMasks() const{
+    return sideToMove == WHITE ? generateKingMasks<WHITE>() : generateKingMasks<BLACK>();
+  }
+
+  //us must be the side to move
+  template<Colors us>
+  const KingMasks& getKingMasks(){
+    assert(us == sideToMove);
+    if(!kingMasksValid){
+      kingMasks = generateKingMasks<us>();
+      kingMasksValid = true;
+    }
+    return kingMasks;
+  }
+  const KingMasks& getKingMasks(){
+    return sideToMove == WHITE ? getKingMasks<WHITE>() : getKingMasks<BLACK>();
+  }
   //Returns the square of the enemy piece which is attacking the square, if there is one. Otherwise returns 64
   uint8_t squareUnderAttack(uint8_t square) const{
     U64 theirPieces = getTheirPieces();
@@ -498,17 +554,18 @@ struct Board{
           |(lookupTables::kingTable[square] & kings & pieces); 
   }
   
-  //squareUnderAttack() except we update canCurrentlyCastle
-  bool kingUnderAttack(uint8_t square){
-    bool result = squareUnderAttack(square) <= 63;
-
-    if((square == sideToMove*56+3) && !result && (castlingRights & (sideToMove*6+2)) && (1ULL << square & ~occupied)){canCurrentlyCastle |= 2;}
-    else if((square == sideToMove*56+5) && !result && (castlingRights & (sideToMove*3+1)) && (1ULL << square & ~occupied)){canCurrentlyCastle |= 1;}
-    
-    return result;
+  //returns a bitboard with the pieces of both colors attacking a certain square, with sliders seeing through everything that is not in occupied
+  //Used for Static Exchange Evaluation, where pieces are removed from occupied as they capture
+  U64 attackersTo(uint8_t square, U64 _occupied) const{
+    return (lookupTables::pawnAttackTable[WHITE][square] & pawns & black)
+          |(lookupTables::pawnAttackTable[BLACK][square] & pawns & white)
+          |(lookupTables::knightTable[square] & knights)
+          |(lookupTables::getBishopAttacks(square, _occupied) & (bishops | queens))
+          |(lookupTables::getRookAttacks(square, _occupied) & (rooks | queens))
+          |(lookupTables::kingTable[square] & kings);
   }
 
-  Pieces findPiece(uint8_t square){
+  Pieces findPiece(uint8_t square) const{
     if(square>63){return null;}
 
     int pieces = mailbox[0][square];
@@ -518,7 +575,9 @@ struct Board{
   }
 
   //DON'T USE THIS; USE chess::makeMove() or search::makeMove() instead
-  void makeMove(Move move){
+  UndoInfo makeMove(Move move){
+    UndoInfo undo = {enPassant, hash, halfmoveClock, castlingRights, startHistoryIndex, mailbox[0][move.getEndSquare()]};
+
     halfmoveClock++;
     const uint8_t startSquare = move.getStartSquare();
     const uint8_t endSquare = move.getEndSquare();
@@ -615,18 +674,98 @@ struct Board{
     
     occupied = white | black;
     sideToMove = Colors(!sideToMove);
+    kingMasksValid = false;
+
+    return undo;
+  }
+
+  //Reverts a move made with makeMove(). DON'T USE THIS; USE chess::unmakeMove() instead
+  void unmakeMove(Move move, const UndoInfo& undo){
+    sideToMove = Colors(!sideToMove);
+    const uint8_t startSquare = move.getStartSquare();
+    const uint8_t endSquare = move.getEndSquare();
+    const MoveFlags moveFlags = move.getMoveFlags();
+    const Pieces movingPiece = moveFlags == PROMOTION ? PAWN : findPiece(endSquare);
+
+    unsetPieces(UNKNOWN, (1ULL << endSquare));
+    unsetColors((1ULL << endSquare), sideToMove);
+    mailbox[0][endSquare] = 0; mailbox[1][endSquare^56] = 0;
+
+    mailbox[0][startSquare] = sideToMove ? movingPiece+6 : movingPiece;
+    mailbox[1][startSquare^56] = sideToMove ? movingPiece : movingPiece+6;
+    setColors((1ULL << startSquare), sideToMove);
+    setPieces(movingPiece, (1ULL << startSquare));
+
+    if(undo.capturedPiece){
+      const Pieces capturedPiece = Pieces(undo.capturedPiece >= 7 ? undo.capturedPiece-6 : undo.capturedPiece);
+      mailbox[0][endSquare] = undo.capturedPiece;
+      mailbox[1][endSquare^56] = undo.capturedPiece >= 7 ? undo.capturedPiece-6 : undo.capturedPiece+6;
+      setColors((1ULL << endSquare), Colors(!sideToMove));
+      setPieces(capturedPiece, (1ULL << endSquare));
+    }
+    else if(moveFlags == ENPASSANT){
+      uint8_t theirPawnSq = sideToMove == WHITE ? endSquare-8 : endSquare+8;
+      mailbox[0][theirPawnSq] = sideToMove ? 1 : 7; mailbox[1][theirPawnSq^56] = sideToMove ? 7 : 1;
+      setColors((1ULL << theirPawnSq), Colors(!sideToMove));
+      setPieces(PAWN, (1ULL << theirPawnSq));
+    }
+    else if(moveFlags == CASTLE){
+      uint8_t rookStartSquare = 0;
+      uint8_t rookEndSquare = 0;
+      //Queenside Castling
+      if(squareIndexToFile(endSquare) == 2){
+        rookStartSquare = sideToMove*56;
+        rookEndSquare = 3+sideToMove*56;
+      }
+      //Kingside Castling
+      else{
+        rookStartSquare = 7+sideToMove*56;
+        rookEndSquare = 5+sideToMove*56;
+      }
+      mailbox[0][rookEndSquare] = 0; mailbox[1][rookEndSquare^56] = 0;
+      unsetColors(rookEndSquare, sideToMove);
+      unsetPieces(ROOK, rookEndSquare);
+
+      mailbox[0][rookStartSquare] = sideToMove ? 10 : 4; mailbox[1][rookStartSquare^56] = sideToMove ? 4 : 10;
+      setColors(rookStartSquare, sideToMove);
+      setPieces(ROOK, rookStartSquare);
+    }
+
+    enPassant = undo.enPassant;
+    hash = undo.hash;
+    halfmoveClock = undo.halfmoveClock;
+    castlingRights = undo.castlingRights;
+    startHistoryIndex = undo.startHistoryIndex;
+
+    occupied = white | black;
+    kingMasksValid = false;
   }
 };
 
-inline Move* generateLegalMoves(Board &board, Move* legalMoves){
+//Returns whether two positions were reached through the same (known) sequence of positions since the last irreversible move
+inline bool equivalentHistory(const Board& board, const History& history, const Board& otherBoard, const History& otherHistory){
+  if(!board.hashed || !otherBoard.hashed){return false;}
+  if(board.startHistoryIndex != otherBoard.startHistoryIndex){return false;}
+  if(board.halfmoveClock != otherBoard.halfmoveClock){return false;}
+
+  size_t positions = board.halfmoveClock - board.startHistoryIndex + 1;
+  if(history.size() < positions || otherHistory.size() < positions){return false;}
+  return std::equal(history.hashes.end()-positions, history.hashes.end(), otherHistory.hashes.end()-positions);
+}
+
+//The move generators are specialized for each side to move, so that pawn directions, castling squares, etc. are known at compile time
+template<Colors us>
+Move* generateLegalMoves(Board &board, Move* legalMoves){
   //Extremely useful source on how pointers/arrays work: https://cplusplus.com/doc/tutorial/pointers/
   Move* legalMovesPtr = legalMoves; //A pointer to the spot in memory where the next move will go
   uint8_t piecePos = 0;
+  constexpr Colors them = Colors(!us);
+  constexpr U64 doublePushRank = us == WHITE ? bitboards::rank4 : bitboards::rank5;
 
-  KingMasks _kingMasks = board.generateKingMasks();
+  const KingMasks& _kingMasks = board.getKingMasks<us>();
 
-  U64 ourPieces = board.getOurPieces();
-  U64 theirPieces = board.getTheirPieces();
+  U64 ourPieces = board.getPieces(us);
+  U64 theirPieces = board.getPieces(them);
   U64 notOurPieces = ~ourPieces;
   
   //Knight cannot move if it is pinned
@@ -640,26 +779,20 @@ inline Move* generateLegalMoves(Board &board, Move* legalMoves){
   pieceBitboard = (ourPieces & board.kings);
   assert(pieceBitboard);
   piecePos = bitscanForward(pieceBitboard);
-  board.canCurrentlyCastle = 0;
 
-  U64 kingMovesBitboard = lookupTables::kingTable[piecePos] & notOurPieces;
-  uint8_t endSquare = 0;
-  board.unsetColors(pieceBitboard, board.sideToMove); //when we check if the new position of king is under attack, we don't want the current king position to block the check
-  while (kingMovesBitboard){
-    endSquare = popLsb(kingMovesBitboard);
-    //check if new position of king is under attack
-    if(!board.kingUnderAttack(endSquare)){*legalMovesPtr++ = Move(piecePos, endSquare);}
-  }
-  board.setColors(pieceBitboard, board.sideToMove); //revert the unsetColors call earlier
+  //the king can move to any square which is not attacked
+  U64 safeSquares = ~_kingMasks.kingDanger;
+  legalMovesPtr = MoveListFromBitboard(lookupTables::kingTable[piecePos] & notOurPieces & safeSquares, piecePos, false, legalMovesPtr);
   //castling
   if(_kingMasks.checkmask == 0xFFFFFFFFFFFFFFFFULL){ //make sure king is not in check
+    U64 emptySafeSquares = safeSquares & ~board.occupied;
     //Queenside castling
-    if((board.canCurrentlyCastle & 0x2) && (1ULL << (board.sideToMove*56+2) & ~board.occupied) && (1ULL << (board.sideToMove*56+1) & ~board.occupied) && !(board.squareUnderAttack(board.sideToMove*56+2)<=63)){
-      *legalMovesPtr++ = Move(piecePos, board.sideToMove*56+2, CASTLE);
+    if((board.castlingRights & (us*6+2)) && (1ULL << (us*56+3) & emptySafeSquares) && (1ULL << (us*56+2) & emptySafeSquares) && (1ULL << (us*56+1) & ~board.occupied)){
+      *legalMovesPtr++ = Move(piecePos, us*56+2, CASTLE);
     }
     //Kingside castling
-    if((board.canCurrentlyCastle & 0x1) && (1ULL << (board.sideToMove*56+6) & ~board.occupied) && !(board.squareUnderAttack(board.sideToMove*56+6)<=63)){
-      *legalMovesPtr++ = Move(piecePos, board.sideToMove*56+6, CASTLE);
+    if((board.castlingRights & (us*3+1)) && (1ULL << (us*56+5) & emptySafeSquares) && (1ULL << (us*56+6) & emptySafeSquares)){
+      *legalMovesPtr++ = Move(piecePos, us*56+6, CASTLE);
     }
   }
 
@@ -672,43 +805,40 @@ inline Move* generateLegalMoves(Board &board, Move* legalMoves){
       //Also, it is not possible to have squares directly in front of the pawn be part of a pinmask if the pawn is pinned unless it is a vertical rook pin
       //So just using the rook mask suffices
       if(!(1ULL << piecePos & _kingMasks.bishopPinnedPieces)){
-        U64 singlePushBb = lookupTables::pawnPushTable[board.sideToMove][piecePos] & ~board.occupied;
-        if(board.sideToMove == WHITE){legalMovesPtr = MoveListFromBitboard((singlePushBb | (singlePushBb << 8 & bitboards::rank4 & ~board.occupied)) & _kingMasks.checkmask & _kingMasks.rookPinmask, piecePos, true, legalMovesPtr);}
-        else{legalMovesPtr = MoveListFromBitboard((singlePushBb | (singlePushBb >> 8 & bitboards::rank5 & ~board.occupied)) & _kingMasks.checkmask & _kingMasks.rookPinmask, piecePos, true, legalMovesPtr);}
+        U64 singlePushBb = lookupTables::pawnPushTable[us][piecePos] & ~board.occupied;
+        legalMovesPtr = MoveListFromBitboard((singlePushBb | (pawnPush<us>(singlePushBb) & doublePushRank & ~board.occupied)) & _kingMasks.checkmask & _kingMasks.rookPinmask, piecePos, true, legalMovesPtr);
       }
 
       //Using similar logic, using just the bishop mask suffices
       if(!(1ULL << piecePos & _kingMasks.rookPinnedPieces)){
-        legalMovesPtr = MoveListFromBitboard(lookupTables::pawnAttackTable[board.sideToMove][piecePos] & theirPieces & _kingMasks.checkmask & _kingMasks.bishopPinmask, piecePos, true, legalMovesPtr);
+        legalMovesPtr = MoveListFromBitboard(lookupTables::pawnAttackTable[us][piecePos] & theirPieces & _kingMasks.checkmask & _kingMasks.bishopPinmask, piecePos, true, legalMovesPtr);
       }
     }
     else{
-      U64 singlePushBb = lookupTables::pawnPushTable[board.sideToMove][piecePos] & ~board.occupied;
-      if(board.sideToMove == WHITE){legalMovesPtr = MoveListFromBitboard((singlePushBb | (singlePushBb << 8 & bitboards::rank4 & ~board.occupied)) & _kingMasks.checkmask, piecePos, PAWN, legalMovesPtr);}
-      else{legalMovesPtr = MoveListFromBitboard((singlePushBb | (singlePushBb >> 8 & bitboards::rank5 & ~board.occupied)) & _kingMasks.checkmask, piecePos, true, legalMovesPtr);}
+      U64 singlePushBb = lookupTables::pawnPushTable[us][piecePos] & ~board.occupied;
+      legalMovesPtr = MoveListFromBitboard((singlePushBb | (pawnPush<us>(singlePushBb) & doublePushRank & ~board.occupied)) & _kingMasks.checkmask, piecePos, true, legalMovesPtr);
 
-      legalMovesPtr = MoveListFromBitboard(lookupTables::pawnAttackTable[board.sideToMove][piecePos] & theirPieces & _kingMasks.checkmask, piecePos, true, legalMovesPtr);
+      legalMovesPtr = MoveListFromBitboard(lookupTables::pawnAttackTable[us][piecePos] & theirPieces & _kingMasks.checkmask, piecePos, true, legalMovesPtr);
     }
 
   }
   //With en passant, we can just test the move
   if(board.enPassant){
     uint8_t enPassantSquare = bitscanForward(board.enPassant);
-    U64 enPassantMovesBitboard = lookupTables::pawnAttackTable[!board.sideToMove][enPassantSquare] & (ourPieces & board.pawns);
+    U64 enPassantMovesBitboard = lookupTables::pawnAttackTable[them][enPassantSquare] & (ourPieces & board.pawns);
 
-    if(board.sideToMove == WHITE){board.unsetColors(board.enPassant >> 8, Colors(!board.sideToMove));}
-    else{board.unsetColors(board.enPassant << 8, Colors(!board.sideToMove));}
-    board.setColors(board.enPassant, board.sideToMove);
+    board.unsetColors(pawnPush<them>(board.enPassant), them);
+    board.setColors(board.enPassant, us);
     while (enPassantMovesBitboard){
       uint8_t startSquare = popLsb(enPassantMovesBitboard);
-      board.unsetColors(1ULL << startSquare, board.sideToMove);
+      board.unsetColors(1ULL << startSquare, us);
       //check if king is under attack
       if(!(board.squareUnderAttack(bitscanForward(ourPieces & board.kings))<=63)){*legalMovesPtr++ = Move(startSquare, enPassantSquare, ENPASSANT);}
 
-      board.setColors(1ULL << startSquare, board.sideToMove);
+      board.setColors(1ULL << startSquare, us);
     }
-    if(board.sideToMove == WHITE){board.setColors(board.enPassant >> 8, Colors(!board.sideToMove));} else{board.setColors(board.enPassant << 8, Colors(!board.sideToMove));}
-    board.unsetColors(board.enPassant, board.sideToMove);
+    board.setColors(pawnPush<them>(board.enPassant), them);
+    board.unsetColors(board.enPassant, us);
   }
 
   pieceBitboard = (ourPieces & board.rooks);
@@ -767,39 +897,44 @@ inline Move* generateLegalMoves(Board &board, Move* legalMoves){
   return legalMovesPtr;
 }
 
-inline Move* generateLegalCaptures(Board &board, Move* legalMoves){
+//Generates legal captures. If findAnyMove is true, hasLegalMoves is also set to whether there is any legal move at all (captures or not),
+//in the same pass over our pieces; this lets playouts check for checkmate/stalemate and get the captures for qSearch at once
+template<Colors us, bool findAnyMove>
+Move* generateLegalCaptures(Board &board, Move* legalMoves, bool& hasLegalMoves){
   //Extremely useful source on how pointers/arrays work: https://cplusplus.com/doc/tutorial/pointers/
   Move* legalMovesPtr = legalMoves; //A pointer to the spot in memory where the next move will go
   uint8_t piecePos = 0;
+  constexpr Colors them = Colors(!us);
+  constexpr U64 doublePushRank = us == WHITE ? bitboards::rank4 : bitboards::rank5;
 
-  KingMasks _kingMasks = board.generateKingMasks();
+  const KingMasks& _kingMasks = board.getKingMasks<us>();
 
-  U64 ourPieces = board.getOurPieces();
-  U64 theirPieces = board.getTheirPieces();
+  U64 ourPieces = board.getPieces(us);
+  U64 theirPieces = board.getPieces(them);
+  //When findAnyMove is false, only captures are ever legal targets
+  U64 targetSquares = findAnyMove ? ~ourPieces : theirPieces;
+  U64 moves = 0ULL;
+  U64 quietMoves = 0ULL; //all the quiet moves we find, only used when findAnyMove is true
   
   //Knight cannot move if it is pinned
   U64 pieceBitboard = (ourPieces & board.knights) & ~(_kingMasks.bishopPinnedPieces | _kingMasks.rookPinnedPieces);
   while(pieceBitboard){
     piecePos = popLsb(pieceBitboard);
 
-    legalMovesPtr = MoveListFromBitboard(lookupTables::knightTable[piecePos] & theirPieces & _kingMasks.checkmask, piecePos, false, legalMovesPtr);
+    moves = lookupTables::knightTable[piecePos] & targetSquares & _kingMasks.checkmask;
+    quietMoves |= moves;
+    legalMovesPtr = MoveListFromBitboard(moves & theirPieces, piecePos, false, legalMovesPtr);
   }
 
   pieceBitboard = (ourPieces & board.kings);
   assert(pieceBitboard);
   piecePos = bitscanForward(pieceBitboard);
-  board.canCurrentlyCastle = 0;
 
-  U64 kingMovesBitboard = lookupTables::kingTable[piecePos] & theirPieces;
-  uint8_t endSquare = 0;
-  board.unsetColors(pieceBitboard, board.sideToMove); //when we check if the new position of king is under attack, we don't want the current king position to block the check
-  while (kingMovesBitboard){
-    endSquare = popLsb(kingMovesBitboard);
-    //check if new position of king is under attack
-    if(!board.kingUnderAttack(endSquare)){*legalMovesPtr++ = Move(piecePos, endSquare);}
-  }
-  board.setColors(pieceBitboard, board.sideToMove); //revert the unsetColors call earlier
-  //dont consider castling, since it is not a capture
+  //the king can move to any square which is not attacked
+  moves = lookupTables::kingTable[piecePos] & targetSquares & ~_kingMasks.kingDanger;
+  quietMoves |= moves;
+  legalMovesPtr = MoveListFromBitboard(moves & theirPieces, piecePos, false, legalMovesPtr);
+  //dont consider castling, since it is not a capture (and it is only legal if the king could also move one square towards the rook)
 
   pieceBitboard = (ourPieces & board.pawns);
   while(pieceBitboard){
@@ -809,37 +944,43 @@ inline Move* generateLegalCaptures(Board &board, Move* legalMoves){
       //if pawn is pinned, you cannot push it unless it is a vertical rook pin. 
       //Also, it is not possible to have squares directly in front of the pawn be part of a pinmask if the pawn is pinned unless it is a vertical rook pin
       //So just using the rook mask suffices
-      //skip generating pawn pushes since they are not captures
+      //pawn pushes are not captures, so we only need them to know if there are any legal moves
+      if(findAnyMove && !quietMoves && !(1ULL << piecePos & _kingMasks.bishopPinnedPieces)){
+        U64 singlePushBb = lookupTables::pawnPushTable[us][piecePos] & ~board.occupied;
+        quietMoves |= (singlePushBb | (pawnPush<us>(singlePushBb) & doublePushRank & ~board.occupied)) & _kingMasks.checkmask & _kingMasks.rookPinmask;
+      }
 
       //Using similar logic, using just the bishop mask suffices
       if(!(1ULL << piecePos & _kingMasks.rookPinnedPieces)){
-        legalMovesPtr = MoveListFromBitboard(lookupTables::pawnAttackTable[board.sideToMove][piecePos] & theirPieces & _kingMasks.checkmask & _kingMasks.bishopPinmask, piecePos, true, legalMovesPtr);
+        legalMovesPtr = MoveListFromBitboard(lookupTables::pawnAttackTable[us][piecePos] & theirPieces & _kingMasks.checkmask & _kingMasks.bishopPinmask, piecePos, true, legalMovesPtr);
       }
     }
     else{
-      //skip generating pawn pushes since they are not captures
-      legalMovesPtr = MoveListFromBitboard(lookupTables::pawnAttackTable[board.sideToMove][piecePos] & theirPieces & _kingMasks.checkmask, piecePos, true, legalMovesPtr);
+      if(findAnyMove && !quietMoves){
+        U64 singlePushBb = lookupTables::pawnPushTable[us][piecePos] & ~board.occupied;
+        quietMoves |= (singlePushBb | (pawnPush<us>(singlePushBb) & doublePushRank & ~board.occupied)) & _kingMasks.checkmask;
+      }
+      legalMovesPtr = MoveListFromBitboard(lookupTables::pawnAttackTable[us][piecePos] & theirPieces & _kingMasks.checkmask, piecePos, true, legalMovesPtr);
     }
 
   }
   //With en passant, we can just test the move
   if(board.enPassant){
     uint8_t enPassantSquare = bitscanForward(board.enPassant);
-    U64 enPassantMovesBitboard = lookupTables::pawnAttackTable[!board.sideToMove][enPassantSquare] & (ourPieces & board.pawns);
+    U64 enPassantMovesBitboard = lookupTables::pawnAttackTable[them][enPassantSquare] & (ourPieces & board.pawns);
 
-    if(board.sideToMove == WHITE){board.unsetColors(board.enPassant >> 8, Colors(!board.sideToMove));}
-    else{board.unsetColors(board.enPassant << 8, Colors(!board.sideToMove));}
-    board.setColors(board.enPassant, board.sideToMove);
+    board.unsetColors(pawnPush<them>(board.enPassant), them);
+    board.setColors(board.enPassant, us);
     while (enPassantMovesBitboard){
       uint8_t startSquare = popLsb(enPassantMovesBitboard);
-      board.unsetColors(1ULL << startSquare, board.sideToMove);
+      board.unsetColors(1ULL << startSquare, us);
       //check if king is under attack
       if(!(board.squareUnderAttack(bitscanForward(ourPieces & board.kings))<=63)){*legalMovesPtr++ = Move(startSquare, enPassantSquare, ENPASSANT);}
 
-      board.setColors(1ULL << startSquare, board.sideToMove);
+      board.setColors(1ULL << startSquare, us);
     }
-    if(board.sideToMove == WHITE){board.setColors(board.enPassant >> 8, Colors(!board.sideToMove));} else{board.setColors(board.enPassant << 8, Colors(!board.sideToMove));}
-    board.unsetColors(board.enPassant, board.sideToMove);
+    board.setColors(pawnPush<them>(board.enPassant), them);
+    board.unsetColors(board.enPassant, us);
   }
 
   pieceBitboard = (ourPieces & board.rooks);
@@ -847,12 +988,10 @@ inline Move* generateLegalCaptures(Board &board, Move* legalMoves){
     piecePos = popLsb(pieceBitboard);
     //if rook is pinned by a bishop it cannot move, so we only check for if it is pinned by a rook
     if(1ULL << piecePos & _kingMasks.bishopPinnedPieces){continue;}
-    if(1ULL << piecePos & _kingMasks.rookPinnedPieces){
-      legalMovesPtr = MoveListFromBitboard(lookupTables::getRookAttacks(piecePos, board.occupied) & theirPieces & _kingMasks.checkmask & _kingMasks.rookPinmask, piecePos, false, legalMovesPtr);  
-    }
-    else{
-      legalMovesPtr = MoveListFromBitboard(lookupTables::getRookAttacks(piecePos, board.occupied) & theirPieces & _kingMasks.checkmask, piecePos, false, legalMovesPtr);     
-    }
+    moves = lookupTables::getRookAttacks(piecePos, board.occupied) & targetSquares & _kingMasks.checkmask;
+    if(1ULL << piecePos & _kingMasks.rookPinnedPieces){moves &= _kingMasks.rookPinmask;}
+    quietMoves |= moves;
+    legalMovesPtr = MoveListFromBitboard(moves & theirPieces, piecePos, false, legalMovesPtr);
   }
 
   pieceBitboard = (ourPieces & board.bishops);
@@ -861,12 +1000,10 @@ inline Move* generateLegalCaptures(Board &board, Move* legalMoves){
 
     //if bishop is pinned by a rook it cannot move, so we only check for if it is pinned by a bishop
     if(1ULL << piecePos & _kingMasks.rookPinnedPieces){continue;}
-    if(1ULL << piecePos & _kingMasks.bishopPinnedPieces){
-      legalMovesPtr = MoveListFromBitboard(lookupTables::getBishopAttacks(piecePos, board.occupied) & theirPieces & _kingMasks.checkmask & _kingMasks.bishopPinmask, piecePos, false, legalMovesPtr);    
-    }
-    else{
-      legalMovesPtr = MoveListFromBitboard(lookupTables::getBishopAttacks(piecePos, board.occupied) & theirPieces & _kingMasks.checkmask, piecePos, false, legalMovesPtr);   
-    }
+    moves = lookupTables::getBishopAttacks(piecePos, board.occupied) & targetSquares & _kingMasks.checkmask;
+    if(1ULL << piecePos & _kingMasks.bishopPinnedPieces){moves &= _kingMasks.bishopPinmask;}
+    quietMoves |= moves;
+    legalMovesPtr = MoveListFromBitboard(moves & theirPieces, piecePos, false, legalMovesPtr);
   }
 
   pieceBitboard = (ourPieces & board.queens);
@@ -876,38 +1013,41 @@ inline Move* generateLegalCaptures(Board &board, Move* legalMoves){
     piecePos = popLsb(pieceBitboard);
 
     //if rook is pinned by a bishop it cannot move, so we only check for if it is pinned by a rook
-    if(1ULL << piecePos & _kingMasks.bishopPinnedPieces){}
-    else if(1ULL << piecePos & _kingMasks.rookPinnedPieces){
-      legalMovesPtr = MoveListFromBitboard(lookupTables::getRookAttacks(piecePos, board.occupied) & theirPieces & _kingMasks.checkmask & _kingMasks.rookPinmask, piecePos, false, legalMovesPtr); 
-    }
-    else{
-      legalMovesPtr = MoveListFromBitboard(lookupTables::getRookAttacks(piecePos, board.occupied) & theirPieces & _kingMasks.checkmask, piecePos, false, legalMovesPtr);   
+    if(!(1ULL << piecePos & _kingMasks.bishopPinnedPieces)){
+      moves = lookupTables::getRookAttacks(piecePos, board.occupied) & targetSquares & _kingMasks.checkmask;
+      if(1ULL << piecePos & _kingMasks.rookPinnedPieces){moves &= _kingMasks.rookPinmask;}
+      quietMoves |= moves;
+      legalMovesPtr = MoveListFromBitboard(moves & theirPieces, piecePos, false, legalMovesPtr);
     }
 
     //as a bishop:
     //if bishop is pinned by a rook it cannot move, so we only check for if it is pinned by a bishop
-    if(1ULL << piecePos & _kingMasks.rookPinnedPieces){}
-    else if(1ULL << piecePos & _kingMasks.bishopPinnedPieces){
-      legalMovesPtr = MoveListFromBitboard(lookupTables::getBishopAttacks(piecePos, board.occupied) & theirPieces & _kingMasks.checkmask & _kingMasks.bishopPinmask, piecePos, false, legalMovesPtr);   
-    }
-    else{
-      legalMovesPtr = MoveListFromBitboard(lookupTables::getBishopAttacks(piecePos, board.occupied) & theirPieces & _kingMasks.checkmask, piecePos, false, legalMovesPtr); 
+    if(!(1ULL << piecePos & _kingMasks.rookPinnedPieces)){
+      moves = lookupTables::getBishopAttacks(piecePos, board.occupied) & targetSquares & _kingMasks.checkmask;
+      if(1ULL << piecePos & _kingMasks.bishopPinnedPieces){moves &= _kingMasks.bishopPinmask;}
+      quietMoves |= moves;
+      legalMovesPtr = MoveListFromBitboard(moves & theirPieces, piecePos, false, legalMovesPtr);
     }
   }
 
+  if constexpr(findAnyMove){
+    hasLegalMoves = quietMoves || legalMovesPtr != legalMoves;
+  }
   return legalMovesPtr;
 }
 
 //Returns whether or not there is a legal move on the given board
 //Used for stalemate and checkmate detection in calls for the getGameStatus() function below
-inline bool isLegalMoves(Board& board){
-  //Extremely useful source on how pointers/arrays work: https://cplusplus.com/doc/tutorial/pointers/
+template<Colors us>
+bool isLegalMoves(Board& board){
   uint8_t piecePos = 0;
+  constexpr Colors them = Colors(!us);
+  constexpr U64 doublePushRank = us == WHITE ? bitboards::rank4 : bitboards::rank5;
 
-  KingMasks _kingMasks = board.generateKingMasks();
+  const KingMasks& _kingMasks = board.getKingMasks<us>();
 
-  U64 ourPieces = board.getOurPieces();
-  U64 theirPieces = board.getTheirPieces();
+  U64 ourPieces = board.getPieces(us);
+  U64 theirPieces = board.getPieces(them);
   U64 notOurPieces = ~ourPieces;
   
   //Knight cannot move if it is pinned
@@ -920,28 +1060,9 @@ inline bool isLegalMoves(Board& board){
 
   pieceBitboard = (ourPieces & board.kings);
   piecePos = bitscanForward(pieceBitboard);
-  board.canCurrentlyCastle = 0;
 
-  U64 kingMovesBitboard = lookupTables::kingTable[piecePos] & notOurPieces;
-  uint8_t endSquare = 0;
-  board.unsetColors(pieceBitboard, board.sideToMove); //when we check if the new position of king is under attack, we don't want the current king position to block the check
-  while (kingMovesBitboard){
-    endSquare = popLsb(kingMovesBitboard);
-    //check if new position of king is under attack
-    if(!board.kingUnderAttack(endSquare)){board.setColors(pieceBitboard, board.sideToMove); return true;}
-  }
-  board.setColors(pieceBitboard, board.sideToMove); //revert the unsetColors call earlier
-  //castling
-  if(_kingMasks.checkmask == 0xFFFFFFFFFFFFFFFFULL){ //make sure king is not in check
-    //Queenside castling
-    if((board.canCurrentlyCastle & 0x2) && (1ULL << (board.sideToMove*56+2) & ~board.occupied) && (1ULL << (board.sideToMove*56+1) & ~board.occupied) && !(board.squareUnderAttack(board.sideToMove*56+2)<=63)){
-      return true;
-    }
-    //Kingside castling
-    if((board.canCurrentlyCastle & 0x1) && (1ULL << (board.sideToMove*56+6) & ~board.occupied) && !(board.squareUnderAttack(board.sideToMove*56+6)<=63)){
-      return true;
-    }
-  }
+  if(lookupTables::kingTable[piecePos] & notOurPieces & ~_kingMasks.kingDanger){return true;}
+  //No need to check castling: castling is only legal if the king could also legally move one square towards the rook
 
 
   pieceBitboard = (ourPieces & board.pawns);
@@ -953,46 +1074,43 @@ inline bool isLegalMoves(Board& board){
       //Also, it is not possible to have squares directly in front of the pawn be part of a pinmask if the pawn is pinned unless it is a vertical rook pin
       //So just using the rook mask suffices
       if(!(1ULL << piecePos & _kingMasks.bishopPinnedPieces)){
-        U64 singlePushBb = lookupTables::pawnPushTable[board.sideToMove][piecePos] & ~board.occupied;
-        if(board.sideToMove == WHITE){if((singlePushBb | (singlePushBb << 8 & bitboards::rank4 & ~board.occupied)) & _kingMasks.checkmask & _kingMasks.rookPinmask){return true;};}
-        else{if((singlePushBb | (singlePushBb >> 8 & bitboards::rank5 & ~board.occupied)) & _kingMasks.checkmask & _kingMasks.rookPinmask){return true;};}
+        U64 singlePushBb = lookupTables::pawnPushTable[us][piecePos] & ~board.occupied;
+        if((singlePushBb | (pawnPush<us>(singlePushBb) & doublePushRank & ~board.occupied)) & _kingMasks.checkmask & _kingMasks.rookPinmask){return true;}
       }
 
       //Using similar logic, using just the bishop mask suffices
       if(!(1ULL << piecePos & _kingMasks.rookPinnedPieces)){
-        if(lookupTables::pawnAttackTable[board.sideToMove][piecePos] & theirPieces & _kingMasks.checkmask & _kingMasks.bishopPinmask){return true;};
+        if(lookupTables::pawnAttackTable[us][piecePos] & theirPieces & _kingMasks.checkmask & _kingMasks.bishopPinmask){return true;};
       }
     }
     else{
-      U64 singlePushBb = lookupTables::pawnPushTable[board.sideToMove][piecePos] & ~board.occupied;
-      if(board.sideToMove == WHITE){if((singlePushBb | (singlePushBb << 8 & bitboards::rank4 & ~board.occupied)) & _kingMasks.checkmask){return true;};}
-      else{if((singlePushBb | (singlePushBb >> 8 & bitboards::rank5 & ~board.occupied)) & _kingMasks.checkmask){return true;};}
+      U64 singlePushBb = lookupTables::pawnPushTable[us][piecePos] & ~board.occupied;
+      if((singlePushBb | (pawnPush<us>(singlePushBb) & doublePushRank & ~board.occupied)) & _kingMasks.checkmask){return true;}
 
-      if(lookupTables::pawnAttackTable[board.sideToMove][piecePos] & theirPieces & _kingMasks.checkmask){return true;};
+      if(lookupTables::pawnAttackTable[us][piecePos] & theirPieces & _kingMasks.checkmask){return true;};
     }
   }
   //With en passant, we can just test the move
   if(board.enPassant){
     uint8_t enPassantSquare = bitscanForward(board.enPassant);
-    U64 enPassantMovesBitboard = lookupTables::pawnAttackTable[!board.sideToMove][enPassantSquare] & (ourPieces & board.pawns);
+    U64 enPassantMovesBitboard = lookupTables::pawnAttackTable[them][enPassantSquare] & (ourPieces & board.pawns);
 
-    if(board.sideToMove == WHITE){board.unsetColors(board.enPassant >> 8, Colors(!board.sideToMove));}
-    else{board.unsetColors(board.enPassant << 8, Colors(!board.sideToMove));}
-    board.setColors(board.enPassant, board.sideToMove);
+    board.unsetColors(pawnPush<them>(board.enPassant), them);
+    board.setColors(board.enPassant, us);
     while (enPassantMovesBitboard){
       uint8_t startSquare = popLsb(enPassantMovesBitboard);
-      board.unsetColors(1ULL << startSquare, board.sideToMove);
+      board.unsetColors(1ULL << startSquare, us);
       //check if king is under attack
       if(!(board.squareUnderAttack(bitscanForward(ourPieces & board.kings))<=63)){
-        if(board.sideToMove == WHITE){board.setColors(board.enPassant >> 8, Colors(!board.sideToMove));} else{board.setColors(board.enPassant << 8, Colors(!board.sideToMove));}
-        board.setColors(1ULL << startSquare, board.sideToMove);
-        board.unsetColors(board.enPassant, board.sideToMove);
+        board.setColors(pawnPush<them>(board.enPassant), them);
+        board.setColors(1ULL << startSquare, us);
+        board.unsetColors(board.enPassant, us);
         return true;
       }
-      board.setColors(1ULL << startSquare, board.sideToMove);
+      board.setColors(1ULL << startSquare, us);
     }
-    if(board.sideToMove == WHITE){board.setColors(board.enPassant >> 8, Colors(!board.sideToMove));} else{board.setColors(board.enPassant << 8, Colors(!board.sideToMove));}
-    board.unsetColors(board.enPassant, board.sideToMove);
+    board.setColors(pawnPush<them>(board.enPassant), them);
+    board.unsetColors(board.enPassant, us);
   }
 
   pieceBitboard = (ourPieces & board.rooks);
@@ -1051,11 +1169,123 @@ inline bool isLegalMoves(Board& board){
   return false;
 }
 
+inline Move* generateLegalMoves(Board &board, Move* legalMoves){
+  return board.sideToMove == WHITE ? generateLegalMoves<WHITE>(board, legalMoves) : generateLegalMoves<BLACK>(board, legalMoves);
+}
+
+inline Move* generateLegalCaptures(Board &board, Move* legalMoves){
+  bool unused = false;
+  return board.sideToMove == WHITE ? generateLegalCaptures<WHITE, false>(board, legalMoves, unused) : generateLegalCaptures<BLACK, false>(board, legalMoves, unused);
+}
+
+inline Move* generateLegalCaptures(Board &board, Move* legalMoves, bool& hasLegalMoves){
+  return board.sideToMove == WHITE ? generateLegalCaptures<WHITE, true>(board, legalMoves, hasLegalMoves) : generateLegalCaptures<BLACK, true>(board, legalMoves, hasLegalMoves);
+}
+
+inline bool isLegalMoves(Board& board){
+  return board.sideToMove == WHITE ? isLegalMoves<WHITE>(board) : isLegalMoves<BLACK>(board);
+}
+
+//Finds the squares each of our pieces can legally capture on (en passant excluded), storing pieces from least to most valuable
+//(pawns, knights, bishops, rooks, queens, king) and skipping pieces without captures. Returns the number of pieces stored
+template<Colors us>
+int findCaptureTargets(Board &board, std::array<uint8_t, 16>& squares, std::array<U64, 16>& targets){
+  int numPieces = 0;
+  uint8_t piecePos = 0;
+
+  const KingMasks& _kingMasks = board.getKingMasks<us>();
+
+  U64 ourPieces = board.getPieces(us);
+  U64 victims = board.getPieces(Colors(!us)) & _kingMasks.checkmask;
+  U64 moves = 0ULL;
+
+  U64 pieceBitboard = (ourPieces & board.pawns) & ~_kingMasks.rookPinnedPieces;
+  while(pieceBitboard){
+    piecePos = popLsb(pieceBitboard);
+    //a pawn pinned by a rook can never capture, and one pinned by a bishop can only capture along the pin
+    moves = lookupTables::pawnAttackTable[us][piecePos] & victims;
+    if(1ULL << piecePos & _kingMasks.bishopPinnedPieces){moves &= _kingMasks.bishopPinmask;}
+    if(moves){squares[numPieces] = piecePos; targets[numPieces++] = moves;}
+  }
+
+  //Knight cannot move if it is pinned
+  pieceBitboard = (ourPieces & board.knights) & ~(_kingMasks.bishopPinnedPieces | _kingMasks.rookPinnedPieces);
+  while(pieceBitboard){
+    piecePos = popLsb(pieceBitboard);
+    moves = lookupTables::knightTable[piecePos] & victims;
+    if(moves){squares[numPieces] = piecePos; targets[numPieces++] = moves;}
+  }
+
+  pieceBitboard = (ourPieces & board.bishops) & ~_kingMasks.rookPinnedPieces;
+  while(pieceBitboard){
+    piecePos = popLsb(pieceBitboard);
+    moves = lookupTables::getBishopAttacks(piecePos, board.occupied) & victims;
+    if(1ULL << piecePos & _kingMasks.bishopPinnedPieces){moves &= _kingMasks.bishopPinmask;}
+    if(moves){squares[numPieces] = piecePos; targets[numPieces++] = moves;}
+  }
+
+  pieceBitboard = (ourPieces & board.rooks) & ~_kingMasks.bishopPinnedPieces;
+  while(pieceBitboard){
+    piecePos = popLsb(pieceBitboard);
+    moves = lookupTables::getRookAttacks(piecePos, board.occupied) & victims;
+    if(1ULL << piecePos & _kingMasks.rookPinnedPieces){moves &= _kingMasks.rookPinmask;}
+    if(moves){squares[numPieces] = piecePos; targets[numPieces++] = moves;}
+  }
+
+  //queens are both a rook and a bishop, and a pin of either kind leaves only the moves along the pin
+  pieceBitboard = (ourPieces & board.queens);
+  while(pieceBitboard){
+    piecePos = popLsb(pieceBitboard);
+    if(1ULL << piecePos & _kingMasks.bishopPinnedPieces){moves = lookupTables::getBishopAttacks(piecePos, board.occupied) & _kingMasks.bishopPinmask;}
+    else if(1ULL << piecePos & _kingMasks.rookPinnedPieces){moves = lookupTables::getRookAttacks(piecePos, board.occupied) & _kingMasks.rookPinmask;}
+    else{moves = lookupTables::getBishopAttacks(piecePos, board.occupied) | lookupTables::getRookAttacks(piecePos, board.occupied);}
+    moves &= victims;
+    if(moves){squares[numPieces] = piecePos; targets[numPieces++] = moves;}
+  }
+
+  //the king is not restricted by the checkmask, only by which squares are attacked
+  piecePos = bitscanForward(ourPieces & board.kings);
+  moves = lookupTables::kingTable[piecePos] & board.getPieces(Colors(!us)) & ~_kingMasks.kingDanger;
+  if(moves){squares[numPieces] = piecePos; targets[numPieces++] = moves;}
+
+  return numPieces;
+}
+
+//Generates the legal en passant captures, if there are any
+template<Colors us>
+Move* generateEnPassant(Board &board, Move* legalMoves){
+  Move* legalMovesPtr = legalMoves;
+  if(!board.enPassant){return legalMovesPtr;}
+  constexpr Colors them = Colors(!us);
+  U64 ourPieces = board.getPieces(us);
+
+  //With en passant, we can just test the move
+  uint8_t enPassantSquare = bitscanForward(board.enPassant);
+  U64 enPassantMovesBitboard = lookupTables::pawnAttackTable[them][enPassantSquare] & (ourPieces & board.pawns);
+
+  board.unsetColors(pawnPush<them>(board.enPassant), them);
+  board.setColors(board.enPassant, us);
+  while (enPassantMovesBitboard){
+    uint8_t startSquare = popLsb(enPassantMovesBitboard);
+    board.unsetColors(1ULL << startSquare, us);
+    if(!(board.squareUnderAttack(bitscanForward(ourPieces & board.kings))<=63)){*legalMovesPtr++ = Move(startSquare, enPassantSquare, ENPASSANT);}
+    board.setColors(1ULL << startSquare, us);
+  }
+  board.setColors(pawnPush<them>(board.enPassant), them);
+  board.unsetColors(board.enPassant, us);
+
+  return legalMovesPtr;
+}
+
 struct MoveList{
   Move moveList[256]; //We assume that 256 is the maximum amount of moves in a position (it is what stockfish uses)
   Move* lastMove; //pointer to the last move in the moveList array
 
   MoveList(Board& board, bool onlyCaptures = false): lastMove(onlyCaptures ? generateLegalCaptures(board, moveList) : generateLegalMoves(board, moveList)){}
+  //Also sets hasLegalMoves to whether there are any legal moves, even if only captures are generated (see generateLegalCaptures())
+  MoveList(Board& board, bool onlyCaptures, bool& hasLegalMoves): lastMove(onlyCaptures ? generateLegalCaptures(board, moveList, hasLegalMoves) : generateLegalMoves(board, moveList)){
+    if(!onlyCaptures){hasLegalMoves = lastMove != moveList;}
+  }
 
   MoveList(const MoveList& moves){
     std::copy(std::begin(moves.moveList), std::end(moves.moveList), std::begin(moveList));
@@ -1076,6 +1306,47 @@ struct MoveList{
   size_t size() const {return lastMove-moveList;}
 };
 
+//Generates legal captures one victim type at a time, from the most to the least valuable victim (queens, rooks, bishops, knights, pawns)
+//Within a stage the least valuable attackers come first, so captures come out in MVV-LVA order without sorting
+//The capture targets of each piece are found once up front; a stage only splits them by victim, 
+//so the moves for less valuable victims are never written out if the caller gets a cutoff first
+struct StagedCaptures{
+  Board& board;
+  int stage = 0;
+  int numPieces = 0;
+  U64 allTargets = 0ULL; //every square we can capture on
+  std::array<uint8_t, 16> pieceSquares; // NOLINT(cppcoreguidelines-pro-type-member-init)
+  std::array<U64, 16> pieceTargets; // NOLINT(cppcoreguidelines-pro-type-member-init)
+  Move moveList[256];
+  Move* lastMove = moveList;
+
+  explicit StagedCaptures(Board& _board): board(_board){
+    numPieces = board.sideToMove == WHITE ? findCaptureTargets<WHITE>(board, pieceSquares, pieceTargets) : findCaptureTargets<BLACK>(board, pieceSquares, pieceTargets);
+    for(int i=0; i<numPieces; i++){allTargets |= pieceTargets[i];}
+  }
+
+  //Generates the captures of the next stage which has any. Returns false once all stages are done
+  bool nextStage(){
+    constexpr std::array<Pieces, 5> victimOrder = {QUEEN, ROOK, BISHOP, KNIGHT, PAWN};
+    while(stage < 5){
+      U64 victims = board.getPieces(Colors(!board.sideToMove), victimOrder[stage++]) & allTargets;
+      lastMove = moveList;
+      for(int i=0; victims && i<numPieces; i++){
+        lastMove = MoveListFromBitboard(pieceTargets[i] & victims, pieceSquares[i], (board.pawns & (1ULL << pieceSquares[i])) != 0, lastMove);
+      }
+      if(stage == 5){
+        lastMove = board.sideToMove == WHITE ? generateEnPassant<WHITE>(board, lastMove) : generateEnPassant<BLACK>(board, lastMove);
+      }
+      if(lastMove != moveList){return true;}
+    }
+    return false;
+  }
+
+  Move* begin() {return moveList;}
+  Move* end() const{return lastMove;}
+  size_t size() const {return lastMove-moveList;}
+};
+
 enum gameStatus: int8_t{WIN = 1, DRAW = 0, LOSS = -1, ONGOING = 2};
 
 inline gameStatus probeWdlTb(Board& board){
@@ -1110,7 +1381,15 @@ inline Move probeDtzTb(Board& board){
   return Move(from_sq, to_sq);
 }
 
-inline gameStatus getGameStatus(Board& board, bool isLegalMoves){
+//Whether the position occurred twice before, which makes it a draw by threefold repetition
+inline bool isRepetition(const Board& board, const History& history){
+  if(!board.hashed){return false;}
+  //Only positions since the last irreversible move (and since the position was set from a fen) can repeat
+  size_t earlierPositions = std::min<size_t>(board.halfmoveClock - board.startHistoryIndex, history.size()-1);
+  return std::count(history.hashes.end()-1-earlierPositions, history.hashes.end()-1, board.hash) >= 2;
+}
+
+inline gameStatus getGameStatus(Board& board, const History& history, bool isLegalMoves){
   /*if(popCount(board.occupied)<=5){
     auto tbProbeResult = tb_probe_wdl(board.white, board.black, board.kings, board.queens, board.rooks, board.bishops, board.knights, board.pawns, board.halfmoveClock, board.castlingRights, board.enPassant ? bitscanForward(board.enPassant) : 0, board.sideToMove==WHITE);
     if(tbProbeResult==TB_RESULT_FAILED){board.printBoard(); assert(0);}
@@ -1120,7 +1399,7 @@ inline gameStatus getGameStatus(Board& board, bool isLegalMoves){
   }*/
   if(!isLegalMoves){
     //If our king is under attack, we lost from checkmate. Otherwise, it is a draw by stalemate.
-    return gameStatus(-(board.squareUnderAttack(bitscanForward(board.getOurPieces(KING)))<=63));
+    return gameStatus(-(board.getKingMasks().checkers != 0));
   }
   //Fifty Move Rule
   if(board.halfmoveClock>=100){return DRAW;}
@@ -1129,8 +1408,7 @@ inline gameStatus getGameStatus(Board& board, bool isLegalMoves){
   (popCount(board.bishops | board.knights)<=1))
   {return DRAW;}
   //Threefold Repetition
-  if(std::count(&board.history[board.startHistoryIndex], &board.history[board.halfmoveClock], board.history[board.halfmoveClock]) >= 2)
-  {return DRAW;}
+  if(isRepetition(board, history)){return DRAW;}
 
   return ONGOING;
 }
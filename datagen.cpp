@@ -1,6 +1,7 @@
 #include "search.h"
 #include <fstream>
 #include <iomanip>
+#include <random>
 #include <thread>
 
 int openingLength = 8;
@@ -9,6 +10,10 @@ int infoPrintInterval = 10;
 
 int numberOfThreads = 8;
 
+int sharedTTMb = 16; //size of the TT all threads share, so positions one thread evaluated are hits for the others. 0 gives each thread its own TT
+//The shared TT's generation goes up once for every numberOfThreads games finished, about once per game on each thread, so another thread's entries from its current game don't count as old
+std::atomic<int> gamesFinished = 0;
+
 float softmaxTemp = 0.2;
 
 int main(){
@@ -22,14 +27,21 @@ int main(){
   version += "-datagen";
 
   search::init();
+  Aurora::outputLevel.value = -1;
   //tb_init("C:\\Users\\kjlji\\OneDrive\\Documents\\VSCode\\C++\\AuroraChessEngine-main\\3-4-5");
 
   std::cout << "Aurora " << version << ", a chess engine by kjljixx\n";
 
+  std::shared_ptr<search::TranspositionTable> sharedTT;
+  if(sharedTTMb){
+    sharedTT = std::make_shared<search::TranspositionTable>();
+    sharedTT->resize(std::max<size_t>(1, size_t(sharedTTMb) * 1000000 / sizeof(search::TTBucket)));
+  }
+
   std::vector<std::thread> threads;
   threads.reserve(numberOfThreads);
   for(int threadId=1; threadId<=numberOfThreads; threadId++) {
-    threads.emplace_back([threadId, version] {
+    threads.emplace_back([threadId, version, sharedTT] {
       std::random_device rd; 
       std::mt19937 eng(rd());
 
@@ -38,12 +50,16 @@ int main(){
       search::timeManagement tm(search::NODES, 450);
 
       chess::Board board;
+      chess::History history;
       chess::Board rootBoard; //Only exists to make the search::makeMove function happy
+      chess::History rootHistory;
       search::Tree tree;
+      if(sharedTT){tree.TT = sharedTT;}
 
       bool validOpening = false;
       while(validOpening == false){
         board.setToFen(chess::startPosFen);
+        history.clear();
 
         for(int i=0; i<openingLength; i++){
           chess::MoveList moves(board);
@@ -52,13 +68,14 @@ int main(){
 
           std::uniform_int_distribution<> distr(0, moves.size() - 1);
           int moveIndex = distr(eng);
-          chess::makeMove(board, moves[moveIndex]);
+          chess::makeMove(board, history, moves[moveIndex]);
         }
-        if(chess::getGameStatus(board, chess::isLegalMoves(board)) == chess::ONGOING){
+        if(chess::getGameStatus(board, history, chess::isLegalMoves(board)) == chess::ONGOING){
           validOpening = true;
         }
       }
       rootBoard = board;
+      rootHistory = history;
 
       int gameIter = 0;
       int fenIter = 0;
@@ -75,21 +92,22 @@ int main(){
       search::Node* root = nullptr;
 
       while(true){
-        if(chess::getGameStatus(board, chess::isLegalMoves(board)) != chess::ONGOING){
+        if(chess::getGameStatus(board, history, chess::isLegalMoves(board)) != chess::ONGOING){
           for(std::string currData : gameData){
             std::cout << "\n" << currData;
           }
           std::cout << "\n";
           board.printBoard();
-          std::cout << "\n" << chess::getGameStatus(board, chess::isLegalMoves(board)) << " " << root->isTerminal;
+          std::cout << "\n" << chess::getGameStatus(board, history, chess::isLegalMoves(board)) << " " << root->isTerminal;
           assert(0);
         }
 
-        search::search(board, tm, tree);
+        search::search(board, history, tm, tree);
         root = tree.root;
         rootBoard = board;
+        rootHistory = history;
 
-        search::Edge bestEdge = search::findBestEdge(root);
+        search::Edge bestEdge = search::findBestAEdge(root);
         search::Edge chosenEdge = bestEdge;
         // float softmaxTotal = 0;
         // for(int i=0; i<root->children.size(); i++){
@@ -120,15 +138,15 @@ int main(){
         totalSearches += 1;
 
         if(board.squareUnderAttack(bitscanForward(board.getOurPieces(chess::KING)))==64 && board.mailbox[0][chosenEdge.edge.getEndSquare()]==0 && std::abs(bestEdge.value)<0.9999){
-          gameData.push_back(board.getFen() + " | " + std::to_string(int(round(tan((board.sideToMove ? search::findBestValue(root) : -search::findBestValue(root))*1.56375)*100))));
+          gameData.push_back(board.getFen() + " | " + std::to_string(int(round(tan((board.sideToMove ? search::findBestQ(root) : -search::findBestQ(root))*1.56375)*100))));
           fenIter++;
         }
 
         float rootVal = chosenEdge.value;
 
-        search::makeMove(board, chosenEdge.edge, rootBoard, tree);
+        search::makeMove(board, history, chosenEdge.edge, rootBoard, rootHistory, tree);
 
-        if((chess::getGameStatus(board, chess::isLegalMoves(board)) != chess::ONGOING) || std::abs(rootVal)>0.9999){
+        if((chess::getGameStatus(board, history, chess::isLegalMoves(board)) != chess::ONGOING) || std::abs(rootVal)>0.9999){
           gameIter++;
           if(gameIter % infoPrintInterval == 0){
             std::cout << "Thread: " << threadId << "\n";
@@ -166,6 +184,7 @@ int main(){
           validOpening = false;
           while(validOpening == false){
             board.setToFen(chess::startPosFen);
+            history.clear();
 
             for(int i=0; i<openingLength; i++){
               chess::MoveList moves(board);
@@ -173,14 +192,16 @@ int main(){
               if(moves.size()==0){break;}
               std::uniform_int_distribution<> distr(0, moves.size() - 1);
               int moveIndex = distr(eng);
-              chess::makeMove(board, moves[moveIndex]);
+              chess::makeMove(board, history, moves[moveIndex]);
             }
-            if(chess::getGameStatus(board, chess::isLegalMoves(board)) == chess::ONGOING){
+            if(chess::getGameStatus(board, history, chess::isLegalMoves(board)) == chess::ONGOING){
               validOpening = true;
             }
             else{}
           }
+          if(sharedTT && ++gamesFinished % numberOfThreads == 0){sharedTT->generation++;}
           rootBoard = board;
+          rootHistory = history;
         }
       }
     });
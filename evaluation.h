@@ -56,6 +56,15 @@ inline const NNUEparameters<NNUEhiddenNeurons>* const nnueParameters = reinterpr
                                                            const NNUEparameters<NNUEhiddenNeurons>*
                                                                            >(gnetworkDataData);
 
+//FNV-1a hash of the embedded network, so data which depends on its evaluations (like tree snapshots) can tell which network it was made with
+inline uint64_t networkHash(){
+  uint64_t hash = 14695981039346656037ULL;
+  for(unsigned int i=0; i<gnetworkDataSize; i++){
+    hash = (hash ^ gnetworkDataData[i]) * 1099511628211ULL;
+  }
+  return hash;
+}
+
 template<int numHiddenNeurons>
 struct NNUE{
   alignas(SIMD::Alignment) std::array<std::array<int16_t, numHiddenNeurons>, 2> accumulator = {{{{0}}}};
@@ -116,7 +125,7 @@ struct NNUE{
     }
   }
 
-  void updateSingleFeature(chess::Board& board, uint8_t square, chess::Pieces newPieceType,
+  void updateSingleFeature(const chess::Board& board, uint8_t square, chess::Pieces newPieceType,
                            chess::Colors newPieceColor = chess::WHITE){
     uint8_t squareFromBlackPerspective = square^56;
 
@@ -141,45 +150,18 @@ struct NNUE{
     }
   }
 
-  void updateAccumulator(chess::Board& board, chess::Move move){
-    U64 newHash = 0ULL;
-    if(board.hashed){
-      newHash = zobrist::updateHash(board, move);
-    }
-
-    board.halfmoveClock++;
+  //Updates the accumulator for a move. This must be called on the board BEFORE the move is made with chess::makeMove();
+  //every square touched by a move is distinct, so each feature change can be read straight from the unmoved board
+  void updateAccumulator(const chess::Board& board, chess::Move move){
     const uint8_t startSquare = move.getStartSquare();
     const uint8_t endSquare = move.getEndSquare();
-    const chess::Pieces movingPiece = board.findPiece(startSquare);
+    const chess::Pieces movingPiece = chess::Pieces(board.mailbox[0][startSquare] >= 7 ? board.mailbox[0][startSquare]-6 : board.mailbox[0][startSquare]);
     const chess::MoveFlags moveFlags = move.getMoveFlags();
 
     updateSingleFeature(board, startSquare, chess::null);
-    board.mailbox[0][startSquare] = 0; board.mailbox[1][startSquare^56] = 0;
-    board.unsetColors((1ULL << startSquare), board.sideToMove);
-    board.unsetPieces(movingPiece, (1ULL << startSquare));
 
     if(moveFlags == chess::ENPASSANT){
-      U64 theirPawnSquare = 0ULL;
-      if(board.sideToMove == chess::WHITE){theirPawnSquare = (1ULL << endSquare) >> 8;}
-      else{theirPawnSquare = (1ULL << endSquare) << 8;}
-
-      uint8_t theirPawnSq = bitscanForward(theirPawnSquare);
-
-      updateSingleFeature(board, theirPawnSq, chess::null);
-      board.mailbox[0][theirPawnSq] = 0; board.mailbox[1][theirPawnSq^56] = 0;
-      board.unsetColors(theirPawnSquare, chess::Colors(!board.sideToMove));
-      board.unsetPieces(chess::PAWN, theirPawnSquare);
-    }
-    else{
-      if(board.getTheirPieces() & (1ULL << endSquare)){
-        board.halfmoveClock = 0;
-        board.startHistoryIndex = 0;
-
-        updateSingleFeature(board, endSquare, chess::null);
-        board.mailbox[0][endSquare] = 0; board.mailbox[1][endSquare^56] = 0;
-        board.unsetColors((1ULL << endSquare), chess::Colors(!board.sideToMove));
-        board.unsetPieces(chess::UNKNOWN, (1ULL << endSquare));
-      }
+      updateSingleFeature(board, board.sideToMove == chess::WHITE ? endSquare-8 : endSquare+8, chess::null);
     }
 
     if(moveFlags == chess::CASTLE){
@@ -197,72 +179,11 @@ struct NNUE{
       }
 
       updateSingleFeature(board, rookStartSquare, chess::null);
-      board.mailbox[0][rookStartSquare] = 0;
-      board.mailbox[1][rookStartSquare^56] = 0;
-      board.unsetColors(rookStartSquare, board.sideToMove);
-      board.unsetPieces(chess::ROOK, rookStartSquare);
-
-
       updateSingleFeature(board, rookEndSquare, chess::ROOK, board.sideToMove);
-      board.mailbox[0][rookEndSquare] = board.sideToMove ? 10 : 4;
-      board.mailbox[1][rookEndSquare^56] = board.sideToMove ? 4 : 10;
-      board.setColors(rookEndSquare, board.sideToMove);
-      board.setPieces(chess::ROOK, rookEndSquare);
     }
 
-    if(moveFlags == chess::PROMOTION){
-      updateSingleFeature(board, endSquare, move.getPromotionPiece(), board.sideToMove);
-      board.mailbox[0][endSquare] = board.sideToMove ? move.getPromotionPiece()+6 : move.getPromotionPiece();
-      board.mailbox[1][endSquare^56] = board.sideToMove ? move.getPromotionPiece() : move.getPromotionPiece()+6;
-      board.setPieces(move.getPromotionPiece(), (1ULL << endSquare));
-    }
-    else{
-      updateSingleFeature(board, endSquare, movingPiece, board.sideToMove);
-      board.mailbox[0][endSquare] = board.sideToMove ? movingPiece+6 : movingPiece;
-      board.mailbox[1][endSquare^56] = board.sideToMove ? movingPiece : movingPiece+6;
-      board.setPieces(movingPiece, (1ULL << endSquare));
-    }
-    board.setColors((1ULL << endSquare), board.sideToMove);
-
-    board.enPassant = 0ULL;
-    if(movingPiece == chess::PAWN){
-      board.halfmoveClock = 0;
-      board.startHistoryIndex = 0;
-      board.enPassant = 0ULL;
-
-      //double pawn push by white
-      if((1ULL << endSquare) == (1ULL << startSquare) << 16){
-        board.enPassant = (1ULL << startSquare) << 8;
-      }
-      //double pawn push by black
-      else if((1ULL << endSquare) == (1ULL << startSquare) >> 16){
-        board.enPassant = (1ULL << startSquare) >> 8;
-      }
-    }
-    //Remove castling rights if king moved
-    if(movingPiece == chess::KING){
-      if(board.sideToMove == chess::WHITE){
-        board.castlingRights &= ~(0x1 | 0x2);
-      }
-      else{
-        board.castlingRights &= ~(0x4 | 0x8);
-      }
-    }
-    //Remove castling rights if rook moved from starting square or if rook was captured
-    if((startSquare == 0 && movingPiece == chess::ROOK) || endSquare == 0){board.castlingRights &= ~0x2;}
-    if((startSquare == 7 && movingPiece == chess::ROOK) || endSquare == 7){board.castlingRights &= ~0x1;}
-    if((startSquare == 56 && movingPiece == chess::ROOK) || endSquare == 56){board.castlingRights &= ~0x8;}
-    if((startSquare == 63 && movingPiece == chess::ROOK) || endSquare == 63){board.castlingRights &= ~0x4;}
-    
-    board.occupied = board.white | board.black;
-    board.sideToMove = chess::Colors(!board.sideToMove);
-
-    if(board.hashed){
-      board.history[board.halfmoveClock] = newHash;
-    }
-    else{
-      board.history[board.halfmoveClock] = zobrist::getHash(board);
-    }
+    //updateSingleFeature removes whatever was captured on endSquare
+    updateSingleFeature(board, endSquare, moveFlags == chess::PROMOTION ? move.getPromotionPiece() : movingPiece, board.sideToMove);
   }
 };
 
@@ -274,115 +195,352 @@ inline const int gamephaseInc[6] = {0, 1, 1, 2, 4, 0};
 
 inline const int gamePhase = 24;
 
-//Static Exchange Evaluation
-//Returns the value in cp from the current board's sideToMove's perspective on how good 
-//capturing an enemy piece on targetSquare is
-//Returns 0 if the capture is not good for the current board's sideToMove or if there is no capture
-//Threshold is the highest SEE value we have already found (see the part in evaluate() which runs SEE())
-inline int SEE(chess::Board& board, uint8_t targetSquare, int threshold = 0, int piecePos = 64){
-  int values[32];
-  int i=0;
-
-  chess::Pieces currPiece = board.findPiece(targetSquare); //The original target piece;
-                                                           //piece of the opponent of the current sideToMove
-  if(currPiece == chess::null){currPiece = chess::PAWN;} //the move is en passant
-  
-  values[i] = (mg_value[currPiece-1] * gamePhase + eg_value[currPiece-1] * (24-gamePhase));
-
-  chess::Colors us = board.sideToMove;
-  U64 white = board.white;
-  U64 black = board.black;
-
-  board.sideToMove = chess::Colors(!board.sideToMove);
-  bool isOurSideToMove = false;
-
-  if(piecePos == 64){
-    piecePos = board.squareUnderAttack(targetSquare);
+//Value of a piece in Static Exchange Evaluation
+inline int seeValue(chess::Pieces piece){
+  return mg_value[piece-1];
+}
+
+//Removes the least valuable piece among attackers from occupied and returns its type, or null if attackers is empty
+inline chess::Pieces popLeastValuableAttacker(const chess::Board& board, U64 attackers, U64& occupied){
+  const std::array<U64, 6> pieceBitboards = {board.pawns, board.knights, board.bishops, board.rooks, board.queens, board.kings};
+  for(int i=0; i<6; i++){
+    if(attackers & pieceBitboards[i]){
+      occupied ^= 1ULL << bitscanForward(attackers & pieceBitboards[i]);
+      return chess::Pieces(i+1);
+    }
   }
-  //See https://www.chessprogramming.org/Alpha-Beta#Negamax_Framework for the
-  //recursive implementation this implementation is based on
-  int alpha = -999999;
-  int beta = -(threshold*24);
+  return chess::null;
+}
 
-  while(piecePos<=63){
-    i++;
+//Adds the sliders which can now see targetSquare through the square piece just left (x-rays)
+//Only sliders on the same kind of line as the piece that moved can have been behind it
+inline U64 addXrayAttackers(const chess::Board& board, uint8_t targetSquare, chess::Pieces piece, U64 attackers, U64 occupied){
+  if(piece == chess::PAWN || piece == chess::BISHOP || piece == chess::QUEEN || piece == chess::KING){
+    attackers |= lookupTables::getBishopAttacks(targetSquare, occupied) & (board.bishops | board.queens);
+  }
+  if(piece == chess::ROOK || piece == chess::QUEEN || piece == chess::KING){
+    attackers |= lookupTables::getRookAttacks(targetSquare, occupied) & (board.rooks | board.queens);
+  }
+  return attackers & occupied;
+}
 
-    //Alpha Beta pruning does not affect the result of the SEE
-    if(-values[i-1] >= beta){break;}
-    if(-values[i-1] > alpha){alpha = -values[i-1];}
-    int placeholder = alpha; alpha = -beta; beta = -placeholder;
+//Static Exchange Evaluation
+//Returns the material balance in cp from the current board's sideToMove's perspective after the exchange on the capture's end square,
+//where either side may stop recapturing whenever that is better for it
+//The attackers of the square are computed once, and sliders behind pieces which have captured are added as the exchange goes on
+inline int SEE(const chess::Board& board, chess::Move move){
+  uint8_t targetSquare = move.getEndSquare();
+  U64 occupied = board.occupied ^ (1ULL << move.getStartSquare());
+  chess::Pieces victim = board.findPiece(targetSquare);
+  if(move.getMoveFlags() == chess::ENPASSANT){
+    victim = chess::PAWN;
+    occupied ^= board.sideToMove == chess::WHITE ? (1ULL << targetSquare) >> 8 : (1ULL << targetSquare) << 8;
+  }
 
-    chess::Pieces leastValuableAttacker = board.findPiece(piecePos);
-    //The value for the enemy of the side of the leastValuableAttacker if the leastValuableAttacker is captured
-    values[i] = (mg_value[leastValuableAttacker-1] * gamePhase + 
-                 eg_value[leastValuableAttacker-1] * (24-gamePhase)) -
-                values[i-1];
+  std::array<int, 32> gain; // NOLINT(cppcoreguidelines-pro-type-member-init)
+  int depth = 0;
+  gain[0] = victim == chess::null ? 0 : seeValue(victim);
+
+  chess::Pieces attacker = board.findPiece(move.getStartSquare());
+  U64 attackers = addXrayAttackers(board, targetSquare, attacker, board.attackersTo(targetSquare, occupied), occupied);
+  chess::Colors side = board.sideToMove;
+
+  while(true){
+    depth++;
+    //what the side which just captured has gained if its attacker gets captured now
+    gain[depth] = seeValue(attacker) - gain[depth-1];
+    side = chess::Colors(!side);
+
+    chess::Pieces nextAttacker = popLeastValuableAttacker(board, attackers & board.getPieces(side), occupied);
+    if(nextAttacker == chess::null){break;}
+    attackers = addXrayAttackers(board, targetSquare, nextAttacker, attackers, occupied);
+    //capturing with the king is only possible if the other side has no attackers left
+    if(nextAttacker == chess::KING && (attackers & board.getPieces(chess::Colors(!side)))){break;}
+    attacker = nextAttacker;
+  }
 
-    board.sideToMove = chess::Colors(!board.sideToMove); isOurSideToMove = !isOurSideToMove;
-    board.unsetColors(1ULL << piecePos, chess::Colors(isOurSideToMove ? us : !us));
+  //The last gain is for a capture that can't happen, so each side picks between standing pat and capturing going backwards from the one before it
+  while(--depth){gain[depth-1] = -std::max(-gain[depth-1], gain[depth]);}
+  return gain[0];
+}
 
-    piecePos = board.squareUnderAttack(targetSquare);
+//Returns whether SEE(board, move) >= threshold, without computing the exact value
+//Stops as soon as one side is sure to end above or below the threshold no matter what happens afterwards
+inline bool SEE(const chess::Board& board, chess::Move move, int threshold){
+  uint8_t targetSquare = move.getEndSquare();
+  U64 occupied = board.occupied ^ (1ULL << move.getStartSquare());
+  chess::Pieces victim = board.findPiece(targetSquare);
+  if(move.getMoveFlags() == chess::ENPASSANT){
+    victim = chess::PAWN;
+    occupied ^= board.sideToMove == chess::WHITE ? (1ULL << targetSquare) >> 8 : (1ULL << targetSquare) << 8;
   }
 
-  board.sideToMove = us;
-  board.white = white;
-  board.black = black;
+  //balance is from the perspective of the side which made the last capture, relative to the threshold
+  int balance = (victim == chess::null ? 0 : seeValue(victim)) - threshold;
+  //even if the capturing piece is not recaptured we are below the threshold
+  if(balance < 0){return false;}
+
+  chess::Pieces attacker = board.findPiece(move.getStartSquare());
+  balance = seeValue(attacker) - balance;
+  //even if the capturing piece is lost for nothing we are still at or above the threshold
+  if(balance <= 0){return true;}
+
+  U64 attackers = addXrayAttackers(board, targetSquare, attacker, board.attackersTo(targetSquare, occupied), occupied);
+  chess::Colors side = board.sideToMove;
+  bool result = true;
+
+  while(true){
+    side = chess::Colors(!side);
+    U64 sideAttackers = attackers & board.getPieces(side);
+    if(!sideAttackers){break;}
+
+    chess::Pieces nextAttacker = popLeastValuableAttacker(board, sideAttackers, occupied);
+    //capturing with the king is only possible if the other side has no attackers left
+    if(nextAttacker == chess::KING){
+      attackers = addXrayAttackers(board, targetSquare, nextAttacker, attackers, occupied);
+      return (attackers & board.getPieces(chess::Colors(!side))) ? result : !result;
+    }
+    result = !result;
+    balance = seeValue(nextAttacker) - balance;
+    if(balance < int(result)){break;}
+    attackers = addXrayAttackers(board, targetSquare, nextAttacker, attackers, occupied);
+  }
+
+  return result;
+}
 
-  return (isOurSideToMove ? beta : -beta)/24;
+//The SEE of the least valuable capture on targetSquare, or 0 if the side to move cannot capture there. Used by the "see" debug command
+inline int SEE(const chess::Board& board, uint8_t targetSquare){
+  U64 occupied = board.occupied;
+  U64 attackers = board.attackersTo(targetSquare, occupied) & board.getPieces(board.sideToMove);
+  if(!attackers || !(board.getTheirPieces() & (1ULL << targetSquare))){return 0;}
+
+  U64 before = occupied;
+  popLeastValuableAttacker(board, attackers, occupied);
+  return SEE(board, chess::Move(bitscanForward(before ^ occupied), targetSquare));
 }
 
 inline const std::array<uint8_t, 13> sidedPieceToPiece = {0, 1, 2, 3, 4, 5, 6, 1, 2, 3, 4, 5, 6};
 
-inline int mvvLva(chess::Board& board, chess::Move move){
-  return 30*mg_value[sidedPieceToPiece[move.getMoveFlags() == chess::ENPASSANT ? 1 : 
-                     board.mailbox[0][move.getEndSquare()]]-1] -
-         mg_value[sidedPieceToPiece[board.mailbox[0][move.getStartSquare()]]-1];
+//Orders captures which were already generated by MVV-LVA (most valuable victim first, then least valuable attacker),
+//using a counting sort over the 5*6 (victim, attacker) pairs instead of comparing moves with each other
+inline void orderCaptures(chess::Board& board, chess::MoveList& moves){
+  std::array<uint8_t, 31> bucketStart = {}; // NOLINT(cppcoreguidelines-pro-type-member-init)
+  std::array<uint8_t, 256> keys; // NOLINT(cppcoreguidelines-pro-type-member-init)
+  for(uint32_t i=0; i<moves.size(); i++){
+    int victim = moves[i].getMoveFlags() == chess::ENPASSANT ? 1 : sidedPieceToPiece[board.mailbox[0][moves[i].getEndSquare()]];
+    int attacker = sidedPieceToPiece[board.mailbox[0][moves[i].getStartSquare()]];
+    keys[i] = (5 - victim) * 6 + attacker - 1;
+    bucketStart[keys[i] + 1]++;
+  }
+  for(int i=1; i<31; i++){bucketStart[i] += bucketStart[i-1];}
+
+  std::array<chess::Move, 256> ordered; // NOLINT(cppcoreguidelines-pro-type-member-init)
+  for(uint32_t i=0; i<moves.size(); i++){ordered[bucketStart[keys[i]]++] = moves[i];}
+  std::copy(ordered.begin(), ordered.begin() + moves.size(), moves.begin());
+}
+
+enum QSearchBound: uint8_t{QS_NONE, QS_EXACT, QS_LOWER, QS_UPPER};
+
+struct QSearchTTEntry{
+  static constexpr uint8_t UNLIMITED = 255;
+
+  uint32_t hash = 0; //upper 32 bits of the zobrist hash
+  int32_t value = 0; //result of qSearch, which is a bound if the search failed high or low
+  int32_t staticEval = 0;
+  QSearchBound bound = QS_NONE;
+  uint8_t depthLeft = 0; //plies qSearch could still go below the position (see qSearchMaxDepth), UNLIMITED without a limit
+};
+
+//qSearch node counts, for bench
+struct QSearchStats{
+  uint64_t nodes = 0;
+  uint64_t ttHits = 0; //number of times a stored result was returned without searching
+  uint64_t deltaPrunes = 0; //number of captures skipped by delta pruning
+  uint64_t leaves = 0; //number of tree leaves evaluated with qSearch
+  uint64_t maxLeafNodes = 0; //the most qSearch nodes any single leaf needed
+};
+
+//Transposition table for the interior nodes of qSearch, so positions reached through different capture orders
+//(or from different leaves of the tree) are not searched again
+//This is separate from the tree's TT, which only holds the final values of leaves
+struct QSearchTT{
+  std::vector<QSearchTTEntry> table;
+  U64 mask = 0;
+
+  QSearchStats stats;
+
+  void resize(uint64_t bytes){
+    //round down to a power of 2 so indexing is just a mask
+    uint64_t entries = 1;
+    while(entries * 2 * sizeof(QSearchTTEntry) <= bytes){entries *= 2;}
+    if(bytes < sizeof(QSearchTTEntry)){entries = 0;}
+    if(table.size() != entries){
+      table.clear();
+      table.resize(entries);
+      mask = entries ? entries - 1 : 0;
+    }
+  }
+
+  void clear(){
+    std::fill(table.begin(), table.end(), QSearchTTEntry());
+  }
+
+  //Returns the entry for this position if there is one, otherwise nullptr
+  QSearchTTEntry* probe(U64 hash){
+    if(table.empty()){return nullptr;}
+    QSearchTTEntry* entry = &table[hash & mask];
+    return (entry->bound != QS_NONE && entry->hash == uint32_t(hash >> 32)) ? entry : nullptr;
+  }
+
+  //Whether an entry's result can be used as is in a search with the given window, which can go depthLeft plies further
+  //A result cut short by a smaller depth limit isn't used
+  static bool cutoff(const QSearchTTEntry* entry, int alpha, int beta, uint8_t depthLeft){
+    return entry && entry->depthLeft >= depthLeft && (entry->bound == QS_EXACT ||
+                    (entry->bound == QS_LOWER && entry->value >= beta) ||
+                    (entry->bound == QS_UPPER && entry->value <= alpha));
+  }
+
+  void store(U64 hash, int value, int staticEval, QSearchBound bound, uint8_t depthLeft){
+    if(table.empty()){return;}
+    table[hash & mask] = {uint32_t(hash >> 32), value, staticEval, bound, depthLeft};
+  }
+};
+
+//The qSearch options, copied once per search as part of search::SearchParams so qSearch doesn't read global Options at every node
+#ifdef CONSTEXPR_SEARCH_PARAMS
+struct QSearchParams{
+  static constexpr int deltaMargin = Aurora::tuned::qSearchDeltaMargin;
+  static constexpr int maxDepth = Aurora::tuned::qSearchMaxDepth; //0 means no limit
+
+  static QSearchParams fromOptions(){return {};}
+};
+#else
+struct QSearchParams{
+  int deltaMargin;
+  int maxDepth; //0 means no limit
+
+  static QSearchParams fromOptions(){
+    return {int(Aurora::qSearchDeltaMargin.value), int(Aurora::qSearchMaxDepth.value)};
+  }
+};
+#endif
+
+//How many plies qSearch can still go below a position at depth
+inline uint8_t qSearchDepthLeft(const QSearchParams& params, int depth){
+  return params.maxDepth ? uint8_t(std::max(params.maxDepth - depth, 0)) : QSearchTTEntry::UNLIMITED;
+}
+
+//The most material a capture can win: the captured piece (at its larger endgame value), plus the promotion if there is one
+inline int maxCaptureGain(const chess::Board& board, chess::Move move){
+  int gain = eg_value[(move.getMoveFlags() == chess::ENPASSANT ? chess::PAWN : board.findPiece(move.getEndSquare())) - 1];
+  if(move.getMoveFlags() == chess::PROMOTION){gain += eg_value[move.getPromotionPiece()-1] - eg_value[chess::PAWN-1];}
+  return gain;
 }
 
 template<int numHiddenNeurons>
-int qSearch(chess::Board& board, NNUE<numHiddenNeurons>& nnue, int alpha, int beta){
-  int eval = nnue.evaluate(board.sideToMove);
-  int bestEval = eval;
+int qSearch(chess::Board& board, chess::History& history, NNUE<numHiddenNeurons>& nnue, QSearchTT& qsTT, const QSearchParams& params, int alpha, int beta, int depth);
 
-  if(eval >= beta){return eval;}
+//Searches a single capture for qSearch, updating alpha and bestEval. Returns true on a beta cutoff
+//staticEval is the stand pat score of the current position and depth the current qSearch depth
+template<int numHiddenNeurons>
+bool searchCapture(chess::Board& board, chess::History& history, NNUE<numHiddenNeurons>& nnue, QSearchTT& qsTT, const QSearchParams& params, int& alpha, int beta, int& bestEval,
+                   int staticEval, int depth, const std::array<std::array<int16_t, numHiddenNeurons>, 2>& currAccumulator, chess::Move move){
+  //Delta pruning: skip the capture if even winning the piece for free (plus a margin for positional gains) can't raise alpha
+  if(staticEval + maxCaptureGain(board, move) + params.deltaMargin <= alpha){
+    qsTT.stats.deltaPrunes++;
+    return false;
+  }
+  if(!SEE(board, move, 0)) return false;
+
+  int eval = 0;
+  //If the table already has a usable result for the position after the capture, we don't even need to make the move
+  U64 childHash = zobrist::updateHash(board, move);
+  const QSearchTTEntry* entry = qsTT.probe(childHash);
+  if(QSearchTT::cutoff(entry, -beta, -alpha, qSearchDepthLeft(params, depth + 1))){
+    qsTT.stats.nodes++; qsTT.stats.ttHits++;
+    eval = -entry->value;
+  }
+  else{
+    nnue.accumulator = currAccumulator;
+    nnue.updateAccumulator(board, move);
+    chess::UndoInfo undo = chess::makeMove(board, history, move, childHash);
+
+    eval = -qSearch(board, history, nnue, qsTT, params, -beta, -alpha, depth + 1);
+
+    chess::unmakeMove(board, history, move, undo);
+  }
 
-  if(eval > alpha){alpha = eval;}
+  if(eval > bestEval) bestEval = eval;
+  if(eval > alpha) alpha = eval;
+  return eval >= beta;
+}
 
-  chess::MoveList moves(board, true);
+template<int numHiddenNeurons>
+int qSearch(chess::Board& board, chess::History& history, NNUE<numHiddenNeurons>& nnue, QSearchTT& qsTT, const QSearchParams& params, int alpha, int beta, int depth){
+  qsTT.stats.nodes++;
+
+  //searchCapture() already checked whether the stored result could be used, so an entry here can only give us the static eval
+  const QSearchTTEntry* entry = qsTT.probe(board.hash);
+  const int staticEval = entry ? entry->staticEval : nnue.evaluate(board.sideToMove);
+  int bestEval = staticEval;
+
+  //At the depth limit we just stand pat. The result depends on the depth we got here at, so it is not stored
+  if(params.maxDepth && depth >= params.maxDepth){return bestEval;}
+  //The results of the positions above the limit are cut short by it too, so they are stored with how far they could search
+  const uint8_t depthLeft = qSearchDepthLeft(params, depth);
+
+  if(bestEval >= beta){
+    qsTT.store(board.hash, bestEval, staticEval, QS_LOWER, depthLeft);
+    return bestEval;
+  }
 
-  std::array<int, 256> orderValue; // NOLINT(cppcoreguidelines-pro-type-member-init)
-  int i=0;
-  for(auto move : moves){orderValue[i] = mvvLva(board, move); i++;}
+  const int originalAlpha = alpha;
+  if(bestEval > alpha){alpha = bestEval;}
 
   std::array<std::array<int16_t, numHiddenNeurons>, 2> currAccumulator = nnue.accumulator;
 
-  for(uint32_t i=0; i<moves.size(); i++){
-    for(uint32_t j=i+1; j<moves.size(); j++) {
-      if(orderValue[j] > orderValue[i]) {
-          std::swap(orderValue[j], orderValue[i]);
-          std::swap(moves.moveList[j], moves.moveList[i]);
+  //Captures are generated in MVV-LVA order a victim type at a time, so a cutoff skips generating the rest
+  chess::StagedCaptures captures(board);
+  while(captures.nextStage()){
+    for(chess::Move move : captures){
+      if(searchCapture<numHiddenNeurons>(board, history, nnue, qsTT, params, alpha, beta, bestEval, staticEval, depth, currAccumulator, move)){
+        qsTT.store(board.hash, bestEval, staticEval, QS_LOWER, depthLeft);
+        return bestEval;
       }
     }
-    if(SEE(board, moves[i].getEndSquare(), -1, moves[i].getStartSquare()) == -1) continue;
-
-    chess::Board movedBoard = board;
-    nnue.accumulator = currAccumulator;
-    nnue.updateAccumulator(movedBoard, moves[i]);
-
-    eval = -qSearch(movedBoard, nnue, -beta, -alpha);
-    
-    if(eval > bestEval) bestEval = eval;
-    if(eval > alpha) alpha = eval;
-    if(eval >= beta) break;
   }
 
+  qsTT.store(board.hash, bestEval, staticEval, bestEval > originalAlpha ? QS_EXACT : QS_UPPER, depthLeft);
   return bestEval;
 }
 
 template<int numHiddenNeurons>
-int evaluate(chess::Board& board, NNUE<numHiddenNeurons>& nnue){
-  int cpEvaluation = qSearch(board, nnue, -999999, 999999);
+int evaluate(chess::Board& board, chess::History& history, NNUE<numHiddenNeurons>& nnue, QSearchTT& qsTT, const QSearchParams& params){
+  int cpEvaluation = qSearch(board, history, nnue, qsTT, params, -999999, 999999, 0);
 
   return cpEvaluation;
 }
-}
\ No newline at end of file
+
+//Same as evaluate(), but reuses captures that were already generated for this position
+//This is what playouts use, so it also keeps track of how many qSearch nodes each leaf takes
+template<int numHiddenNeurons>
+int evaluate(chess::Board& board, chess::History& history, NNUE<numHiddenNeurons>& nnue, QSearchTT& qsTT, const QSearchParams& params, chess::MoveList& captures){
+  const uint64_t startNodes = qsTT.stats.nodes++;
+  int alpha = -999999;
+  const int staticEval = nnue.evaluate(board.sideToMove);
+  int bestEval = staticEval;
+  if(bestEval > alpha){alpha = bestEval;}
+
+  std::array<std::array<int16_t, numHiddenNeurons>, 2> currAccumulator = nnue.accumulator;
+
+  orderCaptures(board, captures);
+  for(chess::Move move : captures){
+    if(searchCapture<numHiddenNeurons>(board, history, nnue, qsTT, params, alpha, 999999, bestEval, staticEval, 0, currAccumulator, move)){break;}
+  }
+
+  qsTT.stats.leaves++;
+  qsTT.stats.maxLeafNodes = std::max(qsTT.stats.maxLeafNodes, qsTT.stats.nodes - startNodes);
+  return bestEval;
+}
+}
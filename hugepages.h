@@ -0,0 +1,239 @@
+#pragma once
+//Allocation of the big, randomly accessed parts of Hash (the TT and the tree's nodes) on 2 mb pages
+//With normal 4 kb pages almost every TT probe or step down the tree needs a TLB miss once Hash is large
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+namespace hugepages{
+
+constexpr size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+enum PageType: uint8_t{NORMAL, TRANSPARENT, EXPLICIT};
+
+inline const char* pageTypeName(PageType pageType){
+  switch(pageType){
+    case EXPLICIT: return "explicit huge pages";
+    case TRANSPARENT: return "transparent huge pages";
+    default: return "normal pages";
+  }
+}
+
+//Allocates at least bytes bytes, aligned to a huge page, and sets pageType to the kind of pages that back it
+//Explicit huge pages (MAP_HUGETLB) are tried first, then transparent huge pages (madvise), and if neither is available normal pages are used
+//Memory from here has to be freed with deallocate() with the same bytes and pageType
+inline void* allocate(size_t bytes, PageType& pageType){
+  bytes = (bytes + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+#ifdef __linux__
+  void* ptr = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+  if(ptr != MAP_FAILED){
+    pageType = EXPLICIT;
+    return ptr;
+  }
+  ptr = std::aligned_alloc(HUGE_PAGE_SIZE, bytes);
+  if(!ptr){throw std::bad_alloc();}
+  pageType = madvise(ptr, bytes, MADV_HUGEPAGE) == 0 ? TRANSPARENT : NORMAL;
+  return ptr;
+#else
+  pageType = NORMAL;
+  void* ptr = ::operator new(bytes, std::align_val_t(HUGE_PAGE_SIZE));
+  return ptr;
+#endif
+}
+
+inline void deallocate(void* ptr, size_t bytes, PageType pageType){
+  if(!ptr){return;}
+  bytes = (bytes + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+#ifdef __linux__
+  if(pageType == EXPLICIT){munmap(ptr, bytes); return;}
+  std::free(ptr);
+#else
+  ::operator delete(ptr, std::align_val_t(HUGE_PAGE_SIZE));
+#endif
+}
+
+//Gives memory freed on the normal heap (like the Edges of evicted nodes) back to the OS
+inline void trimHeap(){
+#ifdef __GLIBC__
+  malloc_trim(0);
+#endif
+}
+
+//Runs work(begin, end) over [0, count) split across all hardware threads, so zeroing and faulting in gigabytes of Hash isn't bound by one core
+inline void parallelFor(size_t count, const std::function<void(size_t, size_t)>& work, size_t minPerThread = 1){
+  size_t numThreads = std::max<size_t>(1, std::min<size_t>(std::thread::hardware_concurrency(), count / std::max<size_t>(1, minPerThread)));
+  if(numThreads == 1){
+    work(0, count);
+    return;
+  }
+  std::vector<std::thread> threads;
+  for(size_t i=0; i<numThreads; i++){
+    threads.emplace_back(work, count * i / numThreads, count * (i + 1) / numThreads);
+  }
+  for(std::thread& thread : threads){thread.join();}
+}
+
+//Hands out blocks of one size, carved out of huge page chunks. Freed blocks are kept for reuse, and chunks are only given back by trim()
+//std::deque allocates its elements in fixed size blocks, so this is where the tree's nodes live (see PoolAllocator)
+struct BlockPool{
+  std::mutex mutex; //several Trees (e.g. in datagen) share a pool
+  size_t blockSize = 0;
+  std::vector<std::pair<void*, PageType>> chunks;
+  size_t usedChunks = 0; //chunks past this one were reserved but haven't been handed out from yet
+  void* freeList = nullptr; //freed blocks, each storing a pointer to the next one
+  char* chunkPtr = nullptr; //the unused part of the current chunk
+  char* chunkEnd = nullptr;
+
+  //Returns nullptr if size is not this pool's block size
+  void* allocate(size_t size){
+    std::lock_guard<std::mutex> lock(mutex);
+    if(blockSize == 0){blockSize = std::max(size, sizeof(void*));}
+    if(size != blockSize){return nullptr;}
+
+    if(freeList){
+      void* block = freeList;
+      freeList = *static_cast<void**>(block);
+      return block;
+    }
+    if(chunkPtr + blockSize > chunkEnd){
+      if(usedChunks == chunks.size()){addChunk();}
+      chunkPtr = static_cast<char*>(chunks[usedChunks++].first);
+      chunkEnd = chunkPtr + HUGE_PAGE_SIZE;
+    }
+    void* block = chunkPtr;
+    chunkPtr += blockSize;
+    return block;
+  }
+
+  //Makes sure at least bytes bytes of chunks exist, and faults them in (in parallel) so the search doesn't have to
+  void reserve(size_t bytes){
+    std::lock_guard<std::mutex> lock(mutex);
+    const size_t firstNew = chunks.size();
+    while(chunks.size() * HUGE_PAGE_SIZE < bytes){addChunk();}
+    parallelFor(chunks.size() - firstNew, [&](size_t begin, size_t end){
+      for(size_t i=firstNew+begin; i<firstNew+end; i++){std::memset(chunks[i].first, 0, HUGE_PAGE_SIZE);}
+    });
+  }
+
+  //Returns false if the block did not come from this pool
+  bool deallocate(void* block, size_t size){
+    std::lock_guard<std::mutex> lock(mutex);
+    if(size != blockSize){return false;}
+    *static_cast<void**>(block) = freeList;
+    freeList = block;
+    return true;
+  }
+
+  //Gives back to the OS every chunk with no blocks in use, except for enough of them to keep keepBytes of chunks around
+  void trim(size_t keepBytes){
+    std::lock_guard<std::mutex> lock(mutex);
+    //chunks are aligned to a huge page, so a block's chunk is its address rounded down
+    std::unordered_map<uintptr_t, size_t> freeBlocks;
+    for(void* block = freeList; block; block = *static_cast<void**>(block)){
+      freeBlocks[reinterpret_cast<uintptr_t>(block) & ~(HUGE_PAGE_SIZE - 1)]++;
+    }
+    auto isUnused = [&](size_t i){
+      if(i >= usedChunks){return true;}
+      char* chunk = static_cast<char*>(chunks[i].first);
+      size_t carvedBlocks = (i + 1 == usedChunks ? size_t(chunkPtr - chunk) : HUGE_PAGE_SIZE) / blockSize;
+      return freeBlocks[reinterpret_cast<uintptr_t>(chunk)] == carvedBlocks;
+    };
+
+    size_t keptBytes = 0;
+    std::vector<bool> keep(chunks.size());
+    for(size_t i=0; i<chunks.size(); i++){
+      keep[i] = !isUnused(i);
+      keptBytes += keep[i] ? HUGE_PAGE_SIZE : 0;
+    }
+    for(size_t i=0; i<chunks.size() && keptBytes < keepBytes; i++){
+      if(!keep[i]){keep[i] = true; keptBytes += HUGE_PAGE_SIZE;}
+    }
+
+    //drop the free blocks of the chunks about to be given back, while they can still be read
+    for(size_t i=0; i<chunks.size(); i++){
+      if(!keep[i]){freeBlocks.erase(reinterpret_cast<uintptr_t>(chunks[i].first));}
+    }
+    void** nextFree = &freeList;
+    for(void* block = freeList; block; block = *static_cast<void**>(block)){
+      if(freeBlocks.count(reinterpret_cast<uintptr_t>(block) & ~(HUGE_PAGE_SIZE - 1))){
+        *nextFree = block;
+        nextFree = static_cast<void**>(block);
+      }
+    }
+    *nextFree = nullptr;
+
+    //carved chunks stay in front of the uncarved ones, and the current chunk stays the last carved one
+    std::vector<std::pair<void*, PageType>> keptChunks;
+    size_t keptUsedChunks = 0;
+    for(size_t i=0; i<chunks.size(); i++){
+      if(keep[i]){
+        keptChunks.push_back(chunks[i]);
+        keptUsedChunks += i < usedChunks;
+      }
+      else{
+        if(i + 1 == usedChunks){chunkPtr = chunkEnd = nullptr;}
+        hugepages::deallocate(chunks[i].first, HUGE_PAGE_SIZE, chunks[i].second);
+      }
+    }
+    chunks = std::move(keptChunks);
+    usedChunks = keptUsedChunks;
+  }
+
+  void addChunk(){
+    PageType pageType = NORMAL;
+    void* chunk = hugepages::allocate(HUGE_PAGE_SIZE, pageType);
+    chunks.push_back({chunk, pageType});
+  }
+
+  PageType pageType(){
+    std::lock_guard<std::mutex> lock(mutex);
+    return chunks.empty() ? NORMAL : chunks.back().second;
+  }
+};
+
+//Allocator for std::deque which takes the element blocks from a BlockPool, and everything else (the deque's map) from the heap
+template<typename T>
+struct PoolAllocator{
+  using value_type = T;
+
+  static BlockPool& pool(){
+    static BlockPool _pool;
+    return _pool;
+  }
+
+  PoolAllocator() = default;
+  template<typename U>
+  PoolAllocator(const PoolAllocator<U>&){} // NOLINT(google-explicit-constructor)
+
+  //the deque's map is an array of pointers, which is always left to the heap
+  T* allocate(size_t n){
+    void* block = std::is_pointer_v<T> ? nullptr : pool().allocate(n * sizeof(T));
+    return static_cast<T*>(block ? block : ::operator new(n * sizeof(T)));
+  }
+  void deallocate(T* ptr, size_t n){
+    if(std::is_pointer_v<T> || !pool().deallocate(ptr, n * sizeof(T))){::operator delete(ptr);}
+  }
+
+  template<typename U>
+  bool operator==(const PoolAllocator<U>&) const{return true;}
+  template<typename U>
+  bool operator!=(const PoolAllocator<U>&) const{return false;}
+};
+
+}
@@ -1,5 +1,6 @@
 #pragma once
 #include "evaluation.h"
+#include "hugepages.h"
 #include <algorithm>
 #include <fstream>
 #include <time.h>
@@ -7,7 +8,12 @@
 #include <memory>
 #include <chrono>
 #include <deque>
+#include <atomic>
+#include <cstring>
 #include <iomanip>
+#include <numeric>
+#include <type_traits>
+#include <unordered_map>
 
 #if DATAGEN >= 1
   std::string dataFolderPath = "C:/Users/kjlji/OneDrive/Documents/VSCode/C++/AuroraChessEngine-main/data";
@@ -31,6 +37,12 @@ struct Edge{
 
   Edge() : child(nullptr), value(-2) {}
   Edge(chess::Move move) : child(nullptr), value(-2), edge(move) {}
+
+  //With lazy expansion (see Aurora::lazyExpansion), a child which only got a static eval stores it shifted up by PENDING, out of the range of searched values,
+  //so minimax (findBestQ) and the choice of the best move leave it out until the child is selected and expanded
+  static constexpr float PENDING = 4;
+  bool isPending() const{return value > 2;}
+  float selectionValue() const{return isPending() ? value - PENDING : value;}
 };
 #pragma pack(pop)
 
@@ -41,8 +53,11 @@ struct Node{
   //For LRU tree management
   Node* backLink = nullptr; //back = node use less recently
   Node* forwardLink = nullptr; //forward = node used more recently
-  //For Tree Reuse
-  Node* newAddress = nullptr;
+  union{
+    Node* newAddress = nullptr; //For Tree Reuse
+    uint64_t snapshotIndex; //For saving the tree (see snapshot.h), never needed at the same time as newAddress
+    uint64_t graphKey; //The position's key (see Tree::graphKey), 0 if it isn't known. Both of the above overwrite it, and put it back when they are done
+  };
 
   uint32_t visits;
   int iters;
@@ -54,6 +69,13 @@ struct Node{
   //For Tree Reuse
   bool mark = false;
 
+  //For the MCTS-solver: the game theoretic result from the side to move's perspective, once the subtree proves one (see updateProven)
+  chess::gameStatus proven = chess::ONGOING;
+  uint16_t provenPlies = 0; //plies until the game ends with the proven result, with best play from both sides
+
+  //For graph mode: the number of nodes other than parent with an edge to this one. Such a node can't be evicted, since those edges would be left dangling
+  uint16_t extraParents = 0;
+
   Node(Node* parent) :
   parent(parent),
   visits(0), iters(0), avgValue(-2), isTerminal(false) {}
@@ -63,6 +85,14 @@ struct Node{
   float variance() const{
     return (sumSquaredVals - (avgValue * avgValue));
   }
+
+  //The value its edge keeps once the node is gone (LRU pruned, or kept in the expansion cache)
+  //An edge without a node only knows a result is 0 plies away, so only a node checkmated right here keeps exactly -1 or 1 (see provenResult).
+  //Any other -1 or 1 would come back as a mate in 1, so it is kept one step short of it
+  float prunedValue() const{
+    if(std::abs(avgValue) != 1 || (proven != chess::ONGOING && provenPlies == 0)){return avgValue;}
+    return std::nextafter(avgValue, 0.0f);
+  }
 };
 
 inline Edge findBestQEdge(Node* parent){
@@ -103,13 +133,80 @@ inline float findBestQ(Node* parent){
   return currBestValue;
 }
 
+//1 + the index of the child with the least Q, or 0 if parent has no children. The TT keeps it as a hint for when the node is created again
+inline uint8_t findBestQHint(Node* parent){
+  float currBestValue = 2;
+  uint8_t hint = 0;
+
+  for(int i=0; i<parent->children.size(); i++){
+    if(parent->children[i].value < currBestValue){
+      currBestValue = parent->children[i].value;
+      hint = i + 1;
+    }
+  }
+
+  return hint;
+}
+
+//The proven result of the edge's child, from the child's side to move's perspective
+//Without a node, only a value of exactly -1 or 1 is proven, and always 0 plies away: those come from checkmates found in playout,
+//or from a checkmated node which LRU pruned (see Node::prunedValue)
+inline chess::gameStatus provenResult(const Edge& edge){
+  if(edge.child){return edge.child->proven;}
+  if(edge.value == 1){return chess::WIN;}
+  if(edge.value == -1){return chess::LOSS;}
+  return chess::ONGOING;
+}
+
+inline uint16_t provenPlies(const Edge& edge){
+  return edge.child ? edge.child->provenPlies : 0;
+}
+
+//Marks node as proven if its children decide the game, then does the same for its parent, for as long as that changes something
+//A node is won if any child is lost, lost if all children are won, and drawn if all children are proven and none of them is lost
+//Proven nodes get their exact result as avgValue, so findBestAEdge picks a proven win over anything else
+inline void updateProven(Node* node){
+  while(node && !node->children.empty()){
+    bool allProven = true;
+    bool anyDraw = false;
+    uint16_t winPlies = UINT16_MAX; //the quickest win
+    uint16_t lossPlies = 0; //the slowest loss
+    for(const Edge& edge : node->children){
+      switch(provenResult(edge)){
+        case chess::LOSS: winPlies = std::min<uint16_t>(winPlies, provenPlies(edge) + 1); break;
+        case chess::WIN: lossPlies = std::max<uint16_t>(lossPlies, provenPlies(edge) + 1); break;
+        case chess::DRAW: anyDraw = true; break;
+        default: allProven = false;
+      }
+    }
+
+    chess::gameStatus result = chess::ONGOING;
+    uint16_t plies = 0;
+    if(winPlies != UINT16_MAX){result = chess::WIN; plies = winPlies;}
+    else if(allProven){result = anyDraw ? chess::DRAW : chess::LOSS; plies = anyDraw ? 0 : lossPlies;}
+
+    if(result == chess::ONGOING || (result == node->proven && plies == node->provenPlies)){return;}
+    node->proven = result;
+    node->provenPlies = plies;
+    node->avgValue = result;
+    node->sumSquaredVals = result * result;
+    node = node->parent;
+  }
+}
+
 inline Edge findBestAEdge(Node* parent){
   float currBestValue = 2; //We want to find the node with the least Q, which is the best move from the parent since Q is from the side to move's perspective
   Edge currBestMove = parent->children[0];
 
   for(int i=0; i<parent->children.size(); i++){
     float currVal = parent->children[i].child ? parent->children[i].child->avgValue : parent->children[i].value;
-    if(currVal < currBestValue){
+    //Between two proven wins take the quicker mate, and between two proven losses the slower one
+    if(currVal == currBestValue && std::abs(currVal) == 1 && provenResult(parent->children[i]) != chess::ONGOING && provenResult(currBestMove) != chess::ONGOING){
+      if(currVal == -1 ? provenPlies(parent->children[i]) < provenPlies(currBestMove) : provenPlies(parent->children[i]) > provenPlies(currBestMove)){
+        currBestMove = parent->children[i];
+      }
+    }
+    else if(currVal < currBestValue){
       currBestValue = currVal;
       currBestMove = parent->children[i];
     }
@@ -119,19 +216,388 @@ inline Edge findBestAEdge(Node* parent){
 }
 
 struct TTEntry{
-  float val = -2;
-  uint32_t hash = 0;
+  static constexpr int16_t EMPTY = INT16_MIN;
+  static constexpr float VALUE_SCALE = 32767; //values are in [-1, 1] and stored as fixed point so an entry fits in 8 bytes
+  static constexpr uint32_t HASH_MASK = 0xFFFFFF;
+
+  //The lower 24 bits are the lower 24 bits of the zobrist hash (the upper bits pick the bucket).
+  //The upper 8 are 1 + the index of the node's best child (in move generation order) when the entry was written. Leaves which are not in the tree yet have 0
+  uint32_t hashAndBestChild = 0;
+  int16_t val = EMPTY;
+  uint8_t visits = 0; //log2(visits + 1) of the node when the entry was written. Leaves which are not in the tree yet have 0
+  uint8_t generation = 0; //TranspositionTable::generation when the entry was written
+
+  static uint32_t packHash(U64 hash, uint8_t bestChild){return uint32_t(hash & HASH_MASK) | (uint32_t(bestChild) << 24);}
+  uint32_t hash() const{return hashAndBestChild & HASH_MASK;}
+  uint8_t bestChild() const{return hashAndBestChild >> 24;}
+
+  //Exactly -1 or 1 would make a leaf proven, but an entry can't tell how many plies away the mate is, so those come back one step short of it
+  float getValue() const{return std::clamp<int16_t>(val, -VALUE_SCALE + 1, VALUE_SCALE - 1) / VALUE_SCALE;}
 };
 
+//A bucket fills exactly one cache line, so a probe touches a single line
+//Each entry is read and written as one 64 bit word with relaxed atomics, so several threads (each with their own Tree) can share a table without locks.
+//Two racing writes can't leave an entry half written, one of them just gets lost, which a TT can afford
+struct alignas(64) TTBucket{
+  static constexpr int size = 8;
+  std::atomic<uint64_t> entries[size];
+
+  //__builtin_bit_cast is std::bit_cast, which needs C++20
+  TTEntry load(int i) const{
+    return __builtin_bit_cast(TTEntry, entries[i].load(std::memory_order_relaxed));
+  }
+  void store(int i, const TTEntry& entry){
+    entries[i].store(__builtin_bit_cast(uint64_t, entry), std::memory_order_relaxed);
+  }
+};
+static_assert(sizeof(TTEntry) == 8 && std::is_trivially_copyable_v<TTEntry>);
+static_assert(sizeof(TTBucket) == 64);
+
+struct TranspositionTable{
+  TTBucket* buckets = nullptr;
+  size_t numBuckets = 0;
+  hugepages::PageType pageType = hugepages::NORMAL;
+  std::atomic<uint8_t> generation = 0; //incremented every search, so entries from earlier searches are replaced first
+
+  //1 mb, below which starting threads costs more than it saves
+  static constexpr size_t MIN_BUCKETS_PER_THREAD = 16384;
+
+  size_t size() const{return numBuckets;}
+
+  TranspositionTable() = default;
+  TranspositionTable(const TranspositionTable&) = delete;
+  TranspositionTable& operator=(const TranspositionTable&) = delete;
+  ~TranspositionTable(){release();}
+
+  //Entries in the table are carried over to the resized one (see migrateBucket), so resizing Hash mid analysis doesn't lose them
+  void resize(size_t targetBuckets){
+    if(numBuckets == targetBuckets){return;}
+    TTBucket* oldBuckets = buckets;
+    size_t oldNumBuckets = numBuckets;
+    hugepages::PageType oldPageType = pageType;
+
+    buckets = static_cast<TTBucket*>(hugepages::allocate(targetBuckets * sizeof(TTBucket), pageType));
+    numBuckets = targetBuckets;
+    hugepages::parallelFor(numBuckets, [&](size_t begin, size_t end){
+      for(size_t i=begin; i<end; i++){
+        new (&buckets[i]) TTBucket();
+        migrateBucket(i, oldBuckets, oldNumBuckets);
+      }
+    }, MIN_BUCKETS_PER_THREAD);
+
+    hugepages::deallocate(oldBuckets, oldNumBuckets * sizeof(TTBucket), oldPageType);
+  }
+
+  //Fills bucket i with the most valuable entries of the old buckets which cover the same hashes
+  //Buckets are picked by the upper bits of the hash, so a bucket covers a contiguous range of buckets in a table of any other size.
+  //Entries only keep the lower 24 bits though, so when growing an entry can't tell which of the new buckets it belongs in and is copied into each of them.
+  //The copies in the wrong buckets never match a probe and are replaced like any other entry
+  void migrateBucket(size_t i, const TTBucket* oldBuckets, size_t oldNumBuckets){
+    std::array<TTEntry, TTBucket::size> kept;
+    int numKept = 0;
+    if(oldNumBuckets){
+      const uint8_t currGeneration = generation.load(std::memory_order_relaxed);
+      size_t first = (__uint128_t(i) * oldNumBuckets) / numBuckets;
+      size_t last = std::min(oldNumBuckets - 1, size_t((__uint128_t(i + 1) * oldNumBuckets - 1) / numBuckets));
+      for(size_t oldBucket=first; oldBucket<=last; oldBucket++){
+        for(int j=0; j<TTBucket::size; j++){
+          TTEntry entry = oldBuckets[oldBucket].load(j);
+          if(entry.val == TTEntry::EMPTY){continue;}
+          if(numKept < TTBucket::size){kept[numKept++] = entry; continue;}
+          int leastWorth = 0;
+          for(int k=1; k<TTBucket::size; k++){
+            if(worth(kept[k], currGeneration) < worth(kept[leastWorth], currGeneration)){leastWorth = k;}
+          }
+          if(worth(entry, currGeneration) > worth(kept[leastWorth], currGeneration)){kept[leastWorth] = entry;}
+        }
+      }
+    }
+    for(int j=0; j<TTBucket::size; j++){buckets[i].store(j, j < numKept ? kept[j] : TTEntry());}
+  }
+
+  //How much an entry is worth keeping: entries from more recent searches first, and among those the ones with more visits
+  static uint32_t worth(const TTEntry& entry, uint8_t currGeneration){
+    uint8_t age = currGeneration - entry.generation;
+    return (uint32_t(255 - age) << 8) | entry.visits;
+  }
+
+  //Also faults in the table's pages, so it's done across all threads here instead of during the search
+  void clear(){
+    hugepages::parallelFor(numBuckets, [&](size_t begin, size_t end){
+      for(size_t i=begin; i<end; i++){
+        for(int j=0; j<TTBucket::size; j++){buckets[i].store(j, TTEntry());}
+      }
+    }, MIN_BUCKETS_PER_THREAD);
+  }
+
+  //Frees the memory of the table, resize() has to be called before it is used again
+  void release(){
+    hugepages::deallocate(buckets, numBuckets * sizeof(TTBucket), pageType);
+    buckets = nullptr;
+    numBuckets = 0;
+  }
+
+  //Multiply-shift maps the hash onto [0, numBuckets) without a division
+  TTBucket& getBucket(U64 hash){
+    return buckets[(__uint128_t(hash) * numBuckets) >> 64];
+  }
+
+  //Starts loading the bucket of this position into cache, so a later probe or store doesn't have to wait for memory
+  void prefetch(U64 hash){
+    if(numBuckets){__builtin_prefetch(&getBucket(hash));}
+  }
+
+  //Returns the entry for this position, which is empty (val == TTEntry::EMPTY) if it isn't in the TT
+  TTEntry probe(U64 hash){
+    TTBucket& bucket = getBucket(hash);
+    for(int i=0; i<TTBucket::size; i++){
+      TTEntry entry = bucket.load(i);
+      if(entry.hash() == (hash & TTEntry::HASH_MASK) && entry.val != TTEntry::EMPTY){return entry;}
+    }
+    return TTEntry();
+  }
+
+  //bestChild is 1 + the index of the node's best child, or 0 for a leaf
+  //Returns false if nothing was written, because the entry for this position is from this search and already the same
+  bool store(U64 hash, float val, uint32_t visits, uint8_t bestChild = 0){
+    TTBucket& bucket = getBucket(hash);
+    const uint8_t currGeneration = generation.load(std::memory_order_relaxed);
+    const TTEntry newEntry = {TTEntry::packHash(hash, bestChild), int16_t(std::lround(val * TTEntry::VALUE_SCALE)), uint8_t(bitscanReverse(uint64_t(visits) + 1)), currGeneration};
+    //Overwrite the entry for this position if there is one. Otherwise replace the least valuable entry:
+    //the one from the oldest search, and among those the one with the least visits (empty entries are from the oldest possible search)
+    int replace = 0;
+    uint32_t replaceWorth = UINT32_MAX;
+    for(int i=0; i<TTBucket::size; i++){
+      TTEntry entry = bucket.load(i);
+      if(entry.val == TTEntry::EMPTY){replace = i; break;}
+      if(entry.hash() == newEntry.hash()){
+        if(entry.generation == currGeneration && entry.val == newEntry.val && entry.visits == newEntry.visits && entry.bestChild() == newEntry.bestChild()){
+          return false;
+        }
+        replace = i;
+        break;
+      }
+      uint32_t entryWorth = worth(entry, currGeneration);
+      if(entryWorth < replaceWorth){replace = i; replaceWorth = entryWorth;}
+    }
+    bucket.store(replace, newEntry);
+    return true;
+  }
+
+  //Fraction of used entries, estimated from the first buckets
+  float hashfull() const{
+    if(numBuckets == 0){return 0;}
+    float used = 0;
+    int numBucketsToCheck = std::min<size_t>(200, numBuckets);
+    for(int i=0; i<numBucketsToCheck; i++){
+      for(int j=0; j<TTBucket::size; j++){
+        if(buckets[i].load(j).val != TTEntry::EMPTY){
+          used += 1;
+        }
+      }
+    }
+    return used / (numBucketsToCheck * TTBucket::size);
+  }
+};
+
+//Keeps the children's values of nodes LRU pruned (see Tree::evictTail), so when one of their positions is expanded again
+//its edges are filled in from here instead of with a playout (and qSearch) each
+//Entries are written one after another into a ring of edges and found through a table of slots keyed by Node::graphKey.
+//An entry is gone once newer ones have overwritten its edges or its slot
+struct ExpansionCache{
+#pragma pack(push, 1)
+  struct CachedEdge{
+    uint16_t move; //chess::Move::value, including the bit for a pruned child
+    float value;
+  };
+#pragma pack(pop)
+  struct Slot{
+    U64 key = 0; //0 for an empty slot
+    uint64_t start = 0; //of the entry's edges, counted in edges ever written, so an entry that was overwritten can be told apart
+    uint32_t size = 0;
+  };
+
+  //Expansion cache counts, reported at the end of a search
+  struct Stats{
+    uint64_t stores = 0;
+    uint64_t probes = 0; //every expansion probes
+    uint64_t hits = 0;
+    uint64_t restoredEdges = 0; //playouts saved
+  };
+
+  //The ring has this many edges per slot, about what a node has
+  static constexpr uint64_t EDGES_PER_SLOT = 32;
+
+  std::vector<Slot> slots;
+  std::vector<CachedEdge> ring;
+  uint64_t written = 0;
+  Stats stats;
+
+  void resize(uint64_t bytes){
+    //round down to a power of 2 so indexing is just a mask
+    const uint64_t slotBytes = sizeof(Slot) + EDGES_PER_SLOT * sizeof(CachedEdge);
+    uint64_t numSlots = 1;
+    while(numSlots * 2 * slotBytes <= bytes){numSlots *= 2;}
+    if(bytes < slotBytes){numSlots = 0;}
+    if(slots.size() != numSlots){
+      slots.clear();
+      slots.resize(numSlots);
+      ring.clear();
+      ring.resize(numSlots * EDGES_PER_SLOT);
+      written = 0;
+    }
+  }
+
+  void clear(){
+    std::fill(slots.begin(), slots.end(), Slot());
+    written = 0;
+  }
+
+  //A child that is still in the tree is kept with its avgValue (see Node::prunedValue) and marked as pruned, the same as evictTail does with the node itself,
+  //since its edge's value is just the playout it started with
+  void store(U64 key, const std::vector<Edge>& children){
+    if(slots.empty() || key == 0 || children.empty() || children.size() > ring.size()){return;}
+    slots[key & (slots.size() - 1)] = {key, written, uint32_t(children.size())};
+    for(const Edge& edge : children){
+      if(edge.child){
+        ring[written++ & (ring.size() - 1)] = {uint16_t(edge.edge.value | (1 << 15)), edge.child->prunedValue()};
+      }
+      else{
+        ring[written++ & (ring.size() - 1)] = {edge.edge.value, edge.value};
+      }
+    }
+    stats.stores++;
+  }
+
+  //Fills in the values of children, just created from the position's moves, from its entry and returns true. Returns false if it has no entry
+  //The moves are compared too, so a position that only shares the key (or a slot overwritten in between) is never restored from
+  bool restore(U64 key, std::vector<Edge>& children){
+    if(slots.empty()){return false;}
+    stats.probes++;
+    const Slot& slot = slots[key & (slots.size() - 1)];
+    if(slot.key != key || slot.size != children.size() || written - slot.start > ring.size()){return false;}
+    for(int i=0; i<children.size(); i++){
+      if((ring[(slot.start + i) & (ring.size() - 1)].move & 0x7FFF) != children[i].edge.value){return false;}
+    }
+    for(int i=0; i<children.size(); i++){
+      const CachedEdge& cached = ring[(slot.start + i) & (ring.size() - 1)];
+      children[i].edge.value = cached.move;
+      children[i].value = cached.value;
+    }
+    stats.hits++;
+    stats.restoredEdges += children.size();
+    return true;
+  }
+};
+
+//The tunable search parameters, copied from their Options once per search so the hot paths (selectEdge, backpropagate) read plain members instead of global Options
+//A build with CONSTEXPR_SEARCH_PARAMS makes them compile time constants (the defaults in Aurora::tuned) instead, so the compiler can fold them into the formulas
+#ifdef CONSTEXPR_SEARCH_PARAMS
+struct SearchParams{
+  static constexpr float rootExplorationFactor = Aurora::tuned::rootExplorationFactor;
+  static constexpr float explorationFactor = Aurora::tuned::explorationFactor;
+  static constexpr float valChangedMinWeight = Aurora::tuned::valChangedMinWeight;
+  static constexpr float valSameMinWeight = Aurora::tuned::valSameMinWeight;
+  static constexpr float varianceScaleMultiplier = Aurora::tuned::varianceScaleMultiplier;
+  static constexpr float varianceScaleOffset = Aurora::tuned::varianceScaleOffset;
+  static constexpr float varianceScaleMin = Aurora::tuned::varianceScaleMin;
+  static constexpr float varianceScaleMax = Aurora::tuned::varianceScaleMax;
+  static constexpr float visitWindow = Aurora::tuned::visitWindow;
+  static constexpr float visitBoostMultiplier = Aurora::tuned::visitBoostMultiplier;
+  static constexpr float visitBoostOffset = Aurora::tuned::visitBoostOffset;
+  static constexpr float bestMoveChangesCoefficient = Aurora::tuned::bestMoveChangesCoefficient;
+  static constexpr float bestMoveChangesExponent = Aurora::tuned::bestMoveChangesExponent;
+  static constexpr float bestMoveChangesMultiplierMin = Aurora::tuned::bestMoveChangesMultiplierMin;
+  static constexpr float bestMoveChangesMultiplierMax = Aurora::tuned::bestMoveChangesMultiplierMax;
+  static constexpr evaluation::QSearchParams qSearch = {};
+
+  static SearchParams fromOptions(){return {};}
+};
+#else
+struct SearchParams{
+  float rootExplorationFactor;
+  float explorationFactor;
+  float valChangedMinWeight;
+  float valSameMinWeight;
+  float varianceScaleMultiplier;
+  float varianceScaleOffset;
+  float varianceScaleMin;
+  float varianceScaleMax;
+  float visitWindow;
+  float visitBoostMultiplier;
+  float visitBoostOffset;
+  float bestMoveChangesCoefficient;
+  float bestMoveChangesExponent;
+  float bestMoveChangesMultiplierMin;
+  float bestMoveChangesMultiplierMax;
+  evaluation::QSearchParams qSearch;
+
+  static SearchParams fromOptions(){
+    return {
+      Aurora::rootExplorationFactor.value,
+      Aurora::explorationFactor.value,
+      Aurora::valChangedMinWeight.value,
+      Aurora::valSameMinWeight.value,
+      Aurora::varianceScaleMultiplier.value,
+      Aurora::varianceScaleOffset.value,
+      Aurora::varianceScaleMin.value,
+      Aurora::varianceScaleMax.value,
+      Aurora::visitWindow.value,
+      Aurora::visitBoostMultiplier.value,
+      Aurora::visitBoostOffset.value,
+      Aurora::bestMoveChangesCoefficient.value,
+      Aurora::bestMoveChangesExponent.value,
+      Aurora::bestMoveChangesMultiplierMin.value,
+      Aurora::bestMoveChangesMultiplierMax.value,
+      evaluation::QSearchParams::fromOptions()
+    };
+  }
+};
+#endif
+
 struct Tree{
-  std::deque<Node> tree;
-  std::vector<TTEntry> TT;
+  std::deque<Node, hugepages::PoolAllocator<Node>> tree;
+  //Several Trees can share one TT (see datagen.cpp). A shared TT has to be sized by whoever shares it, since setHash() leaves it alone
+  std::shared_ptr<TranspositionTable> TT = std::make_shared<TranspositionTable>();
+  evaluation::QSearchTT qsTT;
+  ExpansionCache expansionCache;
+  SearchParams params;
   Node* root = nullptr;
   uint64_t sizeLimit = 0;
   uint64_t currSize = 0;
   Node* tail = nullptr;
   Node* head = nullptr;
 
+  //The TT writes of backpropagation, which are made together at the end of an iteration (see flushTTWrites)
+  struct TTWrite{
+    U64 hash;
+    float value;
+    uint32_t visits;
+    uint8_t bestChild;
+  };
+  std::vector<TTWrite> ttWrites;
+
+  //TT write-back counts, for bench
+  struct TTWriteStats{
+    uint64_t writes = 0; //queued by backpropagation
+    uint64_t skipped = 0; //left out since the entry was already the same (see TranspositionTable::store)
+  };
+  TTWriteStats ttWriteStats;
+
+  //For graph mode (see Aurora::graphSearch): the node of every position, keyed by graphKey()
+  //Only nodes created in graph mode are in it, so the mode can be switched between searches
+  std::unordered_map<U64, Node*> nodeMap;
+  bool graph = false;
+  bool hasSharedNodes = false; //whether a node has ever had more than one parent, after which compaction has to recount them (see relinkParents)
+
+  //Roughly what an entry of nodeMap takes, a heap allocated list node and a bucket pointer. It counts towards the tree's size
+  static constexpr uint64_t NODE_MAP_ENTRY_SIZE = 40;
+
+  //The halfmove clock is part of the key: it only grows along a line of reversible moves, so a node can never become its own descendant
+  static U64 graphKey(const chess::Board& board){
+    return board.hash ^ (uint64_t(board.halfmoveClock) * 0x9E3779B97F4A7C15ULL);
+  }
+
   //Used for nps calculations in printing search info
   int previousVisits = 0;
   float previousElapsed = 0;
@@ -142,38 +608,59 @@ struct Tree{
   //Nodes at the start of a search
   uint32_t startNodes = 0;
 
-  TTEntry* getTTEntry(U64 hash){
-    return &TT[hash % TT.size()];
+  //The kind of pages the tree's nodes are on
+  static hugepages::PageType nodePageType(){
+    return hugepages::PoolAllocator<Node>::pool().pageType();
   }
 
+  //Measured on full trees, Nodes take up 12-15% of the tree's memory
+  static constexpr uint64_t EXPECTED_EDGES_PER_NODE = 32;
+
+  //All sizes are in 64 bits, since Hash can be far bigger than 4 gb
+  //Called when a Hash option is set or on isready, so the memory is allocated and faulted in before the search starts
   void setHash(){
-    float hashMb = Aurora::hash.value;
-    const int BYTES_PER_MB = 1000000;
-    sizeLimit = BYTES_PER_MB * hashMb * (Aurora::ttHash.value ? 1 : 0.8);
-    uint32_t ttHashBytes = Aurora::ttHash.value
-                              ? Aurora::ttHash.value * BYTES_PER_MB
-                              : hashMb * BYTES_PER_MB * 0.2;
-    size_t targetEntries = std::max<size_t>(1, ttHashBytes / sizeof(TTEntry));
-    if(TT.size() != targetEntries){
-      TT.clear();
-      TT.resize(targetEntries);
+    const uint64_t previousSizeLimit = sizeLimit;
+    const uint64_t BYTES_PER_MB = 1000000;
+    const uint64_t hashBytes = uint64_t(Aurora::hash.value) * BYTES_PER_MB;
+    sizeLimit = Aurora::ttHash.value ? hashBytes : hashBytes / 5 * 4;
+    uint64_t ttHashBytes = Aurora::ttHash.value
+                              ? uint64_t(Aurora::ttHash.value) * BYTES_PER_MB
+                              : hashBytes / 5;
+    if(TT.use_count() == 1){
+      TT->resize(std::max<size_t>(1, ttHashBytes / sizeof(TTBucket)));
+    }
+    qsTT.resize(Aurora::qSearchTTHash.value * BYTES_PER_MB);
+    expansionCache.resize(Aurora::expansionCacheHash.value * BYTES_PER_MB);
+    //Nodes are only part of the tree's size, most of it is their children's Edges
+    const uint64_t nodeBytes = sizeLimit / (sizeof(Node) + EXPECTED_EDGES_PER_NODE * sizeof(Edge)) * sizeof(Node);
+    hugepages::PoolAllocator<Node>::pool().reserve(nodeBytes);
+    if(sizeLimit != 0 && (previousSizeLimit == 0 || sizeLimit < previousSizeLimit)){
+      shrink();
+      hugepages::PoolAllocator<Node>::pool().trim(nodeBytes);
+      hugepages::trimHeap();
     }
   }
 
+  //Evicts nodes in LRU order until the tree fits in sizeLimit, then compacts it so the freed memory can be given back
+  void shrink();
+
+  //Makes the queued TT writes. Every bucket is requested before the first one is written, so their cache misses overlap instead of adding up
+  void flushTTWrites(){
+    for(const TTWrite& write : ttWrites){TT->prefetch(write.hash);}
+    for(const TTWrite& write : ttWrites){
+      ttWriteStats.writes++;
+      ttWriteStats.skipped += !TT->store(write.hash, write.value, write.visits, write.bestChild);
+    }
+    ttWrites.clear();
+  }
+
   float getHashfull(){
     float treeHashfull = sizeLimit > 0 ? float(currSize) / sizeLimit : 0;
 
-    float ttHashfull = 0;
-    int numTTEntriesToCheck = std::min(1000, int(TT.size()));
-    for(int i=0; i<numTTEntriesToCheck; i++){
-      if(TT[i].val != -2){
-        ttHashfull += 1;
-      }
-    }
-    ttHashfull /= numTTEntriesToCheck;
+    float ttHashfull = TT->hashfull();
 
-    float totalHash = (TT.size() * sizeof(TTEntry)) + sizeLimit;
-    return (treeHashfull * (sizeLimit / totalHash)) + (ttHashfull * ((TT.size() * sizeof(TTEntry)) / totalHash));
+    float totalHash = (TT->size() * sizeof(TTBucket)) + sizeLimit;
+    return (treeHashfull * (sizeLimit / totalHash)) + (ttHashfull * ((TT->size() * sizeof(TTBucket)) / totalHash));
   }
 
   //for debug purposes
@@ -207,31 +694,59 @@ struct Tree{
     head = node;
   }
 
-  Node* push_back(const Node& node){
-    if(sizeLimit != 0 && currSize >= sizeLimit){
-      assert(tail);
-      Node* currTail = tail;
-      for(int i=0; i<currTail->children.size(); i++){
-        currSize -= sizeof(Edge);
-        if(currTail->children[i].child){
-          currTail->children[i].child->parent = nullptr;
-        }
-      }
-      if(currTail->parent){
-        //Update the 16th bit in the chess::Move to indicate that the child was pruned
-        currTail->parent->children[currTail->index].value = currTail->avgValue;
-        currTail->parent->children[currTail->index].edge.value |= 1 << 15;
-        currTail->parent->children[currTail->index].child = nullptr;
+  //Removes the least recently used node from the tree and the LRU list, and returns its (now unused) slot in tree
+  //The root and nodes with more than one parent are skipped, they are evicted once all but one of their parents are
+  //If a whole pass over the list finds nothing to evict, returns nullptr and the tree has to grow instead
+  //The values of its children are kept in the expansion cache
+  Node* evictTail(){
+    Node* firstSkipped = nullptr;
+    while(tail->extraParents || tail == root){
+      if(tail == firstSkipped || tail == head){return nullptr;}
+      if(!firstSkipped){firstSkipped = tail;}
+      moveToHead(tail);
+    }
+    if(tail == head){return nullptr;}
+    Node* currTail = tail;
+    expansionCache.store(currTail->graphKey, currTail->children);
+    for(int i=0; i<currTail->children.size(); i++){
+      currSize -= sizeof(Edge);
+      Node* child = currTail->children[i].child;
+      if(child){
+        if(child->parent == currTail){child->parent = nullptr;}
+        else{child->extraParents--;}
       }
-      if(currTail->forwardLink){
-        currTail->forwardLink->backLink = nullptr;
+    }
+    currSize -= sizeof(Node);
+    if(!nodeMap.empty()){
+      auto it = nodeMap.find(currTail->graphKey);
+      if(it != nodeMap.end() && it->second == currTail){
+        nodeMap.erase(it);
+        currSize -= NODE_MAP_ENTRY_SIZE;
       }
+    }
+    if(currTail->parent){
+      //Update the 16th bit in the chess::Move to indicate that the child was pruned
+      currTail->parent->children[currTail->index].value = currTail->prunedValue();
+      currTail->parent->children[currTail->index].edge.value |= 1 << 15;
+      currTail->parent->children[currTail->index].child = nullptr;
+    }
 
-      tail = currTail->forwardLink;
-      tail->backLink = nullptr;
+    tail = currTail->forwardLink;
+    tail->backLink = nullptr;
 
+    currTail->children.clear();
+    currTail->children.shrink_to_fit(); //Free Memory
+    currTail->parent = nullptr;
+    currTail->forwardLink = nullptr;
+    return currTail;
+  }
+
+  Node* push_back(const Node& node){
+    Node* currTail = sizeLimit != 0 && currSize >= sizeLimit ? evictTail() : nullptr;
+    //tree is a std::deque, so growing it doesn't move the nodes already in it
+    if(currTail){
       *currTail = node;
-      currTail->children.shrink_to_fit(); //Free Memory
+      currSize += sizeof(Node);
       head->forwardLink = currTail;
       currTail->backLink = head;
       currTail->forwardLink = nullptr;
@@ -254,8 +769,14 @@ struct Tree{
 };
 
 inline void destroyTree(Tree& tree){
-  tree.TT.clear();
+  //a shared TT still has entries other Trees are using
+  //The tables keep their memory so the next search doesn't have to allocate it again
+  if(tree.TT.use_count() == 1){tree.TT->clear();}
+  tree.qsTT.clear();
+  tree.expansionCache.clear();
   tree.tree.clear();
+  tree.nodeMap.clear();
+  tree.hasSharedNodes = false;
   tree.root = nullptr;
   tree.tail = nullptr;
   tree.head = nullptr;
@@ -268,6 +789,8 @@ inline uint64_t markSubtree(Node* node, bool isSubtreeRoot = true, bool unmarked
   if(isSubtreeRoot){
     unmarked = node->mark;
   }
+  //In graph mode a node can be reached through several parents, but is only marked (and counted) once
+  if(node && node->mark != unmarked){return 0;}
   if(node){
     node->mark = !unmarked;
     markedNodes++;
@@ -278,6 +801,25 @@ inline uint64_t markSubtree(Node* node, bool isSubtreeRoot = true, bool unmarked
   return markedNodes;
 }
 
+//Recounts every node's extraParents, after compaction discarded some parents or a snapshot was loaded
+//A node which lost its parent gets the first remaining one in its place
+inline void relinkParents(Tree& tree){
+  for(Node& node : tree.tree){node.extraParents = 0;}
+  for(Node& node : tree.tree){
+    for(int i=0; i<node.children.size(); i++){
+      Node* child = node.children[i].child;
+      if(!child || child->parent == &node){continue;}
+      if(child->parent){
+        child->extraParents++;
+      }
+      else{
+        child->parent = &node;
+        child->index = i;
+      }
+    }
+  }
+}
+
 //Returns a pointer to the new root, which is different from the pointer given as a parameter because of the garbage collection
 inline Node* moveRootToChild(Tree& tree, Node* newRoot){
   //LISP 2 Garbage Collection Algorithm (https://en.wikipedia.org/wiki/Mark%E2%80%93compact_algorithm#LISP_2_algorithm)
@@ -288,10 +830,15 @@ inline Node* moveRootToChild(Tree& tree, Node* newRoot){
   //Index of the next unreserved address in tree.tree
   uint64_t freePointer = 0;
 
+  //newAddress overwrites graphKey, so the keys of the nodes we keep are put aside in their new order
+  std::vector<U64> keys;
+  keys.reserve(markedNodes);
+
   //Reserve addresses for all nodes we want to keep
-  for(uint32_t i=0; i<tree.tree.size(); i++){
+  for(size_t i=0; i<tree.tree.size(); i++){
     Node* livePointer = &tree.tree[i];
     if(livePointer->mark == marked){
+      keys.push_back(livePointer->graphKey);
       livePointer->newAddress = &tree.tree[freePointer];
       freePointer++;
     }
@@ -337,8 +884,9 @@ inline Node* moveRootToChild(Tree& tree, Node* newRoot){
     if(node.mark == marked){
       tree.currSize += sizeof(Node);
       if(node.parent){
-        assert(&node == newRoot || node.parent->mark == marked);
-        node.parent = node.parent->newAddress;
+        //Only the new root's parent is discarded in a tree. In graph mode other nodes can lose theirs too, while another parent keeps them
+        assert(&node == newRoot || tree.hasSharedNodes || node.parent->mark == marked);
+        node.parent = node.parent->mark == marked ? node.parent->newAddress : nullptr;
       }
       if(node.backLink){
         node.backLink = node.backLink->newAddress;
@@ -359,8 +907,16 @@ inline Node* moveRootToChild(Tree& tree, Node* newRoot){
   tree.head = tree.head->newAddress;
   tree.tail = tree.tail->newAddress;
 
+  //Carry nodeMap over to the new addresses while newAddress can still be read, and drop the nodes which are discarded
+  std::unordered_map<U64, Node*> nodeMap;
+  for(const auto& [key, node] : tree.nodeMap){
+    if(node->mark == marked){nodeMap.emplace(key, node->newAddress);}
+  }
+  tree.nodeMap = std::move(nodeMap);
+  tree.currSize += tree.nodeMap.size() * Tree::NODE_MAP_ENTRY_SIZE;
+
   //Move nodes to new addresses
-  for(uint32_t i=0; i<tree.tree.size(); i++){
+  for(size_t i=0; i<tree.tree.size(); i++){
     Node* livePointer = &tree.tree[i];
     if(livePointer->mark == marked){
       *(livePointer->newAddress) = *livePointer;
@@ -370,51 +926,125 @@ inline Node* moveRootToChild(Tree& tree, Node* newRoot){
 
   tree.tree.resize(markedNodes);
 
+  for(size_t i=0; i<tree.tree.size(); i++){tree.tree[i].graphKey = keys[i];}
+  if(tree.hasSharedNodes){relinkParents(tree);}
+
   return newRootNewAddress;
 }
 
-inline uint8_t selectEdge(Node* parent, bool isRoot){
-  float maxPriority = -2;
-  uint8_t maxPriorityNodeIndex = 0;
+inline void Tree::shrink(){
+  if(!root || currSize <= sizeLimit){return;}
+  while(currSize > sizeLimit && tail != head && evictTail()){}
 
-  const float parentVisitsTerm = (isRoot ? Aurora::rootExplorationFactor.value : Aurora::explorationFactor.value)*std::log(parent->visits)*std::sqrt(std::log(parent->visits));
+  //Evicted nodes (and earlier orphans of evictions) can be left with either mark, so reset all of them before marking what the root can reach
+  for(Node& node : tree){node.mark = root->mark;}
+  root = moveRootToChild(*this, root);
+}
+
+//The stats selectEdge needs from each child, gathered into contiguous arrays while the traversal moves the children in the LRU list anyway,
+//so the selection itself is a pass over these instead of following a pointer per child
+struct ChildStats{
+  static constexpr int WIDTH = 8; //floats per AVX2 register, the arrays are padded to a multiple of it
+  alignas(32) std::array<float, 256> q; //the child's avgValue, or the edge's value if there is no child
+  alignas(32) std::array<int32_t, 256> visits; //the child's visits. Without a child 1, or 0 if it was pruned by LRU
+  int size = 0;
+
+  //Proven children are never selected: searching them can't change their result. Like the padding lanes they get a priority of -infinity
+  //Returns the child's proven result
+  chess::gameStatus set(int i, const Edge& edge){
+    chess::gameStatus result = provenResult(edge);
+    if(result != chess::ONGOING){
+      q[i] = INFINITY;
+      visits[i] = 1;
+    }
+    else if(edge.child){
+      q[i] = edge.child->avgValue;
+      visits[i] = edge.child->visits;
+    }
+    else{
+      q[i] = edge.selectionValue();
+      visits[i] = (edge.edge.value & (1 << 15)) ? 0 : 1;
+    }
+    return result;
+  }
+
+  //Padding lanes get a priority of -infinity, so they are never selected
+  void pad(){
+    for(int i=size; i%WIDTH; i++){
+      q[i] = INFINITY;
+      visits[i] = 1;
+    }
+  }
+};
+
+//Computes the priority of every child from stats (gathered from parent) and returns the index of the first one with the highest priority
+//The arithmetic, including where it's done in double, follows the scalar formula exactly, so the vectorized selection picks the same child
+inline uint8_t selectEdge(Node* parent, ChildStats& stats, bool isRoot, const SearchParams& params){
+  const float parentVisitsTerm = (isRoot ? params.rootExplorationFactor : params.explorationFactor)*std::log(parent->visits)*std::sqrt(std::log(parent->visits));
 
   float varianceScale = 
     ((1.0 / parent->iters) * 1.0) +
     ((1.0 - 1.0 / parent->iters) *
     std::clamp<double>(
-      1.0 + (Aurora::varianceScaleMultiplier.value *
-            (std::sqrt(std::max(parent->variance(), float(0))) - Aurora::varianceScaleOffset.value)),
-      Aurora::varianceScaleMin.value,
-      Aurora::varianceScaleMax.value
+      1.0 + (params.varianceScaleMultiplier *
+            (std::sqrt(std::max(parent->variance(), float(0))) - params.varianceScaleOffset)),
+      params.varianceScaleMin,
+      params.varianceScaleMax
     ));
-  
-  // std::cout << std::clamp(1.0+32*(std::sqrt(std::max(parent->variance(), float(0)))-0.00625), 0.2, 2.0) << " ";
-
-  for(int i=0; i<parent->children.size(); i++){
-    Node* currNode = parent->children[i].child;
-    Edge currEdge = parent->children[i];
-
-    //We can make a guess about how many visits a node had before it was pruned by LRU
-    bool isLRUPruned = parent->children[i].edge.value & (1 << 15);
-
-    float childVisits = currNode ? currNode->visits : 1;
-    float boostTerm = 1.0 + ((Aurora::visitBoostMultiplier.value * (parent->visits * Aurora::visitBoostOffset.value)) / 
-                      (parent->visits * Aurora::visitBoostOffset.value + childVisits));
-
-    float currPriority = -(currNode ? currNode->avgValue : currEdge.value) +
-      ((boostTerm *
-      varianceScale *
-      parentVisitsTerm) / std::sqrt(currNode ? currNode->visits : (isLRUPruned ? 14 : 1)));
 
-    assert(currPriority>=-1);
-
-    if(currPriority>maxPriority){
-      maxPriority = currPriority;
-      maxPriorityNodeIndex = i;
-    }
+  //The visit boost is boostNumerator / (boostOffset + childVisits) (We can make a guess about how many visits a node had before it was pruned by LRU)
+  const float boostOffset = parent->visits * params.visitBoostOffset;
+  const float boostNumerator = params.visitBoostMultiplier * boostOffset;
+
+  alignas(32) std::array<float, 256> priorities;
+  stats.pad();
+#ifdef __AVX2__
+  const __m256 boostOffsetVec = _mm256_set1_ps(boostOffset);
+  const __m256 boostNumeratorVec = _mm256_set1_ps(boostNumerator);
+  const __m256 varianceScaleVec = _mm256_set1_ps(varianceScale);
+  const __m256 parentVisitsTermVec = _mm256_set1_ps(parentVisitsTerm);
+  const __m256i one = _mm256_set1_epi32(1);
+  const __m256i prunedVisits = _mm256_set1_epi32(14);
+  const __m256d oneDouble = _mm256_set1_pd(1.0);
+  __m256 maxPriorities = _mm256_set1_ps(-INFINITY);
+  for(int i=0; i<stats.size; i+=ChildStats::WIDTH){
+    __m256i visits = _mm256_load_si256(reinterpret_cast<const __m256i*>(&stats.visits[i]));
+    __m256 q = _mm256_load_ps(&stats.q[i]);
+
+    __m256 boostFraction = _mm256_div_ps(boostNumeratorVec, _mm256_add_ps(boostOffsetVec, _mm256_cvtepi32_ps(_mm256_max_epi32(visits, one))));
+    __m256 boostTerm = _mm256_set_m128(
+      _mm256_cvtpd_ps(_mm256_add_pd(oneDouble, _mm256_cvtps_pd(_mm256_extractf128_ps(boostFraction, 1)))),
+      _mm256_cvtpd_ps(_mm256_add_pd(oneDouble, _mm256_cvtps_pd(_mm256_castps256_ps128(boostFraction))))
+    );
+    __m256 explorationTerm = _mm256_mul_ps(_mm256_mul_ps(boostTerm, varianceScaleVec), parentVisitsTermVec);
+
+    __m256i sqrtVisits = _mm256_blendv_epi8(visits, prunedVisits, _mm256_cmpeq_epi32(visits, _mm256_setzero_si256()));
+    __m256d lowPriorities = _mm256_sub_pd(
+      _mm256_div_pd(_mm256_cvtps_pd(_mm256_castps256_ps128(explorationTerm)), _mm256_sqrt_pd(_mm256_cvtepi32_pd(_mm256_castsi256_si128(sqrtVisits)))),
+      _mm256_cvtps_pd(_mm256_castps256_ps128(q)));
+    __m256d highPriorities = _mm256_sub_pd(
+      _mm256_div_pd(_mm256_cvtps_pd(_mm256_extractf128_ps(explorationTerm, 1)), _mm256_sqrt_pd(_mm256_cvtepi32_pd(_mm256_extracti128_si256(sqrtVisits, 1)))),
+      _mm256_cvtps_pd(_mm256_extractf128_ps(q, 1)));
+    __m256 currPriorities = _mm256_set_m128(_mm256_cvtpd_ps(highPriorities), _mm256_cvtpd_ps(lowPriorities));
+
+    _mm256_store_ps(&priorities[i], currPriorities);
+    maxPriorities = _mm256_max_ps(maxPriorities, currPriorities);
+  }
+  alignas(32) std::array<float, ChildStats::WIDTH> lanes;
+  _mm256_store_ps(lanes.data(), maxPriorities);
+  const float maxPriority = *std::max_element(lanes.begin(), lanes.end());
+#else
+  float maxPriority = -INFINITY;
+  for(int i=0; i<stats.size; i++){
+    float boostTerm = 1.0 + (boostNumerator / (boostOffset + std::max(stats.visits[i], 1)));
+    priorities[i] = -stats.q[i] + ((boostTerm * varianceScale * parentVisitsTerm) / std::sqrt(stats.visits[i] ? stats.visits[i] : 14));
+    maxPriority = std::max(maxPriority, priorities[i]);
   }
+#endif
+  assert(maxPriority>=-1);
 
+  uint8_t maxPriorityNodeIndex = 0;
+  while(priorities[maxPriorityNodeIndex] != maxPriority){maxPriorityNodeIndex++;}
   return maxPriorityNodeIndex;
 }
 
@@ -429,36 +1059,69 @@ inline void expand(Tree& tree, Node* parent, chess::MoveList& moves){
   }
 }
 
-template<int numHiddenNeurons>
-float playout(Tree& tree,chess::Board& board, evaluation::NNUE<numHiddenNeurons>& nnue){
-  //First, check if position is terminal
-  chess::gameStatus _gameStatus = chess::getGameStatus(board, chess::isLegalMoves(board));
+//The result of a position which needs no eval: the game's result if it is over, otherwise the TB's. chess::ONGOING if it has neither
+inline float knownResult(chess::Board& board, chess::History& history, bool hasLegalMoves){
+  chess::gameStatus _gameStatus = chess::getGameStatus(board, history, hasLegalMoves);
   assert(-1<=_gameStatus && 2>=_gameStatus);
   if(_gameStatus != chess::ONGOING){
     return _gameStatus;
   }
 
-  //Next, check TBs
+  //A TB win or loss isn't a mate, so it is kept one step short of 1 or -1, which would make the child proven (see provenResult)
   chess::gameStatus tbResult = chess::probeWdlTb(board);
   if(tbResult != chess::ONGOING){
-    return tbResult;
+    return std::nextafter(float(tbResult), 0.0f);
+  }
+  return chess::ONGOING;
+}
+
+template<int numHiddenNeurons>
+float playout(Tree& tree, chess::Board& board, chess::History& history, evaluation::NNUE<numHiddenNeurons>& nnue){
+  //A position that is over (or in the TBs) is never scored from the TT, but for a TT hit it is enough to know if there is any legal move at all
+  //On a miss, the captures for qSearch are generated in the same pass that looks for one
+  TTEntry entry = tree.TT->probe(board.hash);
+  if(entry.val != TTEntry::EMPTY){
+    float result = knownResult(board, history, chess::isLegalMoves(board));
+    return result != chess::ONGOING ? result : entry.getValue();
   }
 
-  //Next, check TT
-  TTEntry* entry = tree.getTTEntry(board.history[board.halfmoveClock]);
-  if(entry->hash == (board.history[board.halfmoveClock] >> 32) && entry->val != -2){
-    return entry->val;
+  bool hasLegalMoves = false;
+  chess::MoveList captures(board, true, hasLegalMoves);
+  float result = knownResult(board, history, hasLegalMoves);
+  if(result != chess::ONGOING){
+    return result;
   }
 
   //Next, do qSearch
-  float eval = evaluation::cpToVal(evaluation::evaluate(board, nnue));
-  entry->hash = (board.history[board.halfmoveClock] >> 32);
-  entry->val = eval;
+  float eval = evaluation::cpToVal(evaluation::evaluate(board, history, nnue, tree.qsTT, tree.params.qSearch, captures));
+  tree.TT->store(board.hash, eval, 0);
 
   assert(-1<=eval && 1>=eval);
   return eval;
 }
 
+//The cheap first guess at a child's value for lazy expansion: the TT's value if it has one, otherwise the static eval without qSearch
+//Unlike playout(), it doesn't generate moves, so a checkmate or stalemate is only found once the child gets a playout or is expanded
+template<int numHiddenNeurons>
+float staticValue(Tree& tree, chess::Board& board, evaluation::NNUE<numHiddenNeurons>& nnue){
+  TTEntry entry = tree.TT->probe(board.hash);
+  if(entry.val != TTEntry::EMPTY){
+    return entry.getValue();
+  }
+  return evaluation::cpToVal(nnue.evaluate(board.sideToMove));
+}
+
+//Counts an iteration through node and moves its avgValue (and sumSquaredVals) towards value
+//A proven node keeps the exact result updateProven gave it, whatever is backpropagated through it
+inline void addValue(Node* node, float value, float minWeight){
+  node->iters++;
+  if(node->proven != chess::ONGOING){return;}
+  float newValWeight = std::clamp(1.0/node->iters, double(minWeight), 1.0);
+  node->avgValue = (node->avgValue * (1 - newValWeight)) + (value * newValWeight);
+  node->sumSquaredVals = (node->sumSquaredVals * (1 - newValWeight)) + (value * value * newValWeight);
+}
+
+//The TT writes along the way are queued in tree.ttWrites, for the caller to make with Tree::flushTTWrites
 inline void backpropagate(Tree& tree, float result, std::vector<std::pair<Edge*, U64>>& edges, uint8_t visits, bool forceResult, bool runFindBestMove, bool continueBackprop){
   //Backpropagate results
   if(edges.size() == 0){return;}
@@ -481,14 +1144,9 @@ inline void backpropagate(Tree& tree, float result, std::vector<std::pair<Edge*,
     if(result <= currEdge->value && !runFindBestMove && !forceResult){
       continueBackprop = false;
 
-      currEdge->child->iters++;
-      float newValWeight = std::clamp(1.0/currEdge->child->iters, double(Aurora::valSameMinWeight.value), 1.0);
-      currEdge->child->avgValue = (currEdge->child->avgValue * (1 - newValWeight)) + (currEdge->value * newValWeight);
-      currEdge->child->sumSquaredVals = (currEdge->child->sumSquaredVals * (1 - newValWeight)) + (currEdge->value * currEdge->value * newValWeight);
+      addValue(currEdge->child, currEdge->value, tree.params.valSameMinWeight);
 
-      TTEntry* entry = tree.getTTEntry(hash);
-      entry->hash = hash >> 32;
-      entry->val = currEdge->value;
+      tree.ttWrites.push_back({hash, currEdge->value, currEdge->child->visits, findBestQHint(currEdge->child)});
 
       backpropagate(tree, result, edges, visits, false, runFindBestMove, continueBackprop);
       return;
@@ -502,25 +1160,25 @@ inline void backpropagate(Tree& tree, float result, std::vector<std::pair<Edge*,
 
     result = -currEdge->value;
 
-    currEdge->child->iters++;
-    float newValWeight = std::clamp(1.0/currEdge->child->iters, double(Aurora::valChangedMinWeight.value), 1.0);
-    currEdge->child->avgValue = (currEdge->child->avgValue * (1 - newValWeight)) + (currEdge->value * newValWeight);
-    currEdge->child->sumSquaredVals = (currEdge->child->sumSquaredVals * (1 - newValWeight)) + (currEdge->value * currEdge->value * newValWeight);
+    addValue(currEdge->child, currEdge->value, tree.params.valChangedMinWeight);
   }
   else{
-    currEdge->child->iters++;
-    float newValWeight = std::clamp(1.0/currEdge->child->iters, double(Aurora::valSameMinWeight.value), 1.0);
-    currEdge->child->avgValue = (currEdge->child->avgValue * (1 - newValWeight)) + (currEdge->value * newValWeight);
-    currEdge->child->sumSquaredVals = (currEdge->child->sumSquaredVals * (1 - newValWeight)) + (currEdge->value * currEdge->value * newValWeight);
+    addValue(currEdge->child, currEdge->value, tree.params.valSameMinWeight);
   }
 
-  TTEntry* entry = tree.getTTEntry(hash);
-  entry->hash = hash >> 32;
-  entry->val = currEdge->value;
+  tree.ttWrites.push_back({hash, currEdge->value, currEdge->child->visits, findBestQHint(currEdge->child)});
 
   backpropagate(tree, result, edges, visits, false, runFindBestMove, continueBackprop);
 }
 
+//The UCI score of node, which is a mate score once the node is proven
+inline std::string scoreString(Node* node){
+  if(node->proven == chess::WIN){return "mate " + std::to_string((node->provenPlies + 1) / 2);}
+  if(node->proven == chess::LOSS){return "mate -" + std::to_string(node->provenPlies / 2);}
+  if(node->proven == chess::DRAW){return "cp 0";}
+  return "cp " + std::to_string(evaluation::valToCp(-findBestQ(node)));
+}
+
 inline void printSearchInfo(Tree& tree, std::chrono::steady_clock::time_point start, bool finalResult){
   Node* root = tree.root;
   if(Aurora::outputLevel.value >= 3){
@@ -548,7 +1206,7 @@ inline void printSearchInfo(Tree& tree, std::chrono::steady_clock::time_point st
 
     std::sort(sortedEdges.begin(), sortedEdges.end(), 
         [](const Edge& a, const Edge& b) {
-          return a.value < b.value;
+          return a.selectionValue() < b.selectionValue();
         });
 
     for(int i = 0; i < sortedEdges.size(); i++) {
@@ -556,7 +1214,7 @@ inline void printSearchInfo(Tree& tree, std::chrono::steady_clock::time_point st
 
       std::cout << std::left
                 << std::setw(8) << currEdge.edge.toStringRep()
-                << std::setw(12) << -currEdge.value
+                << std::setw(12) << -currEdge.selectionValue()
                 << std::setw(12) << -(currEdge.child ? currEdge.child->avgValue : -2)
                 << std::setw(12) << (currEdge.child ? currEdge.child->iters : 0)
                 << std::setw(12) << (currEdge.child ? currEdge.child->visits : 1)
@@ -582,7 +1240,7 @@ inline void printSearchInfo(Tree& tree, std::chrono::steady_clock::time_point st
     "info depth " << (root->visits == tree.startNodes ? 0 : int(tree.depth / (root->visits - tree.startNodes))) <<
     " seldepth " << int(tree.seldepth) <<
     " nodes " << root->visits <<
-    " score cp " << evaluation::valToCp(-findBestQ(root)) <<
+    " score " << scoreString(root) <<
     " hashfull " << int(tree.getHashfull()*1000) <<
     " nps " << std::round((root->visits-tree.previousVisits)/(elapsed.count()-tree.previousElapsed)) <<
     " time " << std::round(elapsed.count()*1000) <<
@@ -612,22 +1270,52 @@ struct timeManagement{
   float hardLimit = 0;
   float limit = 0; //For FOREVER, this does not matter. For Nodes, this is the amount of nodes. For Time, it is the amount of seconds
   bool useSoftHardNodeLimits = false;
+  int mate = 0; //For go mate, a proven win at the root only ends the search once it is a mate in at most this many moves
   timeManagement(timeManagementType _tmType, uint32_t _limit = 0): tmType(_tmType), hardLimit(_limit), limit(_limit) {}
   timeManagement() {}
 };
 
+//Whether the search should go on after the root was proven. It can only look for a quicker mate, among the root's children which aren't proven yet
+inline bool keepSearchingProvenRoot(Node* root, const timeManagement& tm){
+  if(root->proven != chess::WIN){return false;}
+  if(tm.tmType != FOREVER || (tm.mate && root->provenPlies <= 2 * tm.mate - 1)){return false;}
+  for(const Edge& edge : root->children){
+    if(provenResult(edge) == chess::ONGOING){return true;}
+  }
+  return false;
+}
+
+//Unmakes every move in the path, from the last one made to the first
+inline void unmakePath(chess::Board& board, chess::History& history, std::vector<chess::Move>& movePath, std::vector<chess::UndoInfo>& undoPath){
+  while(!movePath.empty()){
+    chess::unmakeMove(board, history, movePath.back(), undoPath.back());
+    movePath.pop_back();
+    undoPath.pop_back();
+  }
+}
+
 //The main search function
-inline void search(chess::Board& rootBoard, timeManagement tm, Tree& tree){
+//history must end with rootBoard's position (it is pushed if rootBoard is not yet hashed); it is used for the whole search and is left as it was given
+inline void search(chess::Board& rootBoard, chess::History& history, timeManagement tm, Tree& tree){
   auto start = std::chrono::steady_clock::now();
 
   tree.setHash();
+  tree.params = SearchParams::fromOptions();
+  tree.graph = Aurora::graphSearch.value;
+  const int lazyExpansion = Aurora::lazyExpansion.value;
+  const bool warmStart = Aurora::ttWarmStart.value;
+  //A shared TT is aged by whoever shares it (see datagen.cpp). If each of its Trees aged it every search, the entries of the others would look old right away
+  if(tree.TT.use_count() == 1){tree.TT->generation++;}
+  tree.expansionCache.stats = ExpansionCache::Stats();
+  tree.ttWriteStats = Tree::TTWriteStats();
   if(Aurora::outputLevel.value >= 1){
     std::cout << "info string starting search with max tree size " <<
               (tree.sizeLimit == 0 ? "unlimited" : std::to_string(tree.sizeLimit/1000000.0)) << " mb "
               << "and TT size " <<
-              (tree.TT.size()*sizeof(TTEntry)/1000000.0) << " mb"
+              (tree.TT->size()*sizeof(TTBucket)/1000000.0) << " mb "
+              << "(TT on " << hugepages::pageTypeName(tree.TT->pageType) << ", tree on " << hugepages::pageTypeName(tree.nodePageType()) << ")"
               << std::endl;
-    if(tree.TT.size() == 1){
+    if(tree.TT->size() == 1){
       std::cout << "info string WARNING: TT is disabled, set either TTHash or Hash option to a non-zero value to enable" << std::endl;
     }
   }
@@ -647,7 +1335,9 @@ inline void search(chess::Board& rootBoard, timeManagement tm, Tree& tree){
   tree.previousVisits = tree.root->visits;
   tree.previousElapsed = 0;
 
-  if(chess::getGameStatus(rootBoard, chess::isLegalMoves(rootBoard)) != chess::ONGOING){
+  chess::ensureHashed(rootBoard, history);
+
+  if(chess::getGameStatus(rootBoard, history, chess::isLegalMoves(rootBoard)) != chess::ONGOING){
     if(Aurora::outputLevel.value >= 0){
       std::cout << "bestmove a1a1" << std::endl;
     }
@@ -679,60 +1369,16 @@ inline void search(chess::Board& rootBoard, timeManagement tm, Tree& tree){
     tm.limit = -1;
   }
 
-  while((tm.tmType == FOREVER) ||
-        (tm.tmType == TIME &&
-          ((tm.useSoftHardNodeLimits && elapsed.count()<std::min(tm.limit*bestMoveChangesMultiplier, tm.hardLimit)) ||
-          (!tm.useSoftHardNodeLimits && elapsed.count()<tm.limit))
-        ) ||
-        (tm.tmType == NODES &&
-          ((tm.useSoftHardNodeLimits && (tree.root->visits - tree.startNodes) < std::min(tm.limit*bestMoveChangesMultiplier, tm.hardLimit)) ||
-          (!tm.useSoftHardNodeLimits && (tree.root->visits - tree.startNodes) < tm.limit))
-        ) ||
-        (tm.tmType == ITERS &&
-          ((tm.useSoftHardNodeLimits && tree.root->iters < std::min(tm.limit*bestMoveChangesMultiplier, tm.hardLimit)) ||
-          (!tm.useSoftHardNodeLimits && tree.root->iters < tm.limit))
-        )
-      ){
-    chess::Board board = rootBoard;
-
-    int currDepth = 0;
-    currNode = tree.root; tree.moveToHead(tree.root);
-    Edge* currEdge = nullptr;
-    std::vector<std::pair<Edge*, U64>> traversePath;
-
-    //Traverse the search tree
-    while(currNode->children.size() > 0){
-      currDepth++;
-      
-      //Move all children nodes to the front of LRU
-      for(int i=0; i<currNode->children.size(); i++){
-        if(currNode->children[i].child != nullptr){
-          tree.moveToHead(currNode->children[i].child);
-        }
-      }
+  //The search makes and unmakes moves on a single copy of the root board
+  chess::Board board = rootBoard;
+  std::vector<std::pair<Edge*, U64>> traversePath;
+  std::vector<chess::Move> movePath;
+  std::vector<chess::UndoInfo> undoPath;
+  ChildStats childStats;
+  std::array<U64, 256> childHashes; // NOLINT(cppcoreguidelines-pro-type-member-init)
 
-      //Select Child Node to explore
-      uint8_t currEdgeIndex = selectEdge(currNode, currNode == tree.root);
-
-      currEdge = &currNode->children[currEdgeIndex];
-      chess::makeMove(board, currEdge->edge);
-      traversePath.push_back({currEdge, board.history[board.halfmoveClock]});
-
-      //If we only had a child edge before, create the corresponding child node
-      if(currEdge->child == nullptr){
-        currEdge->child = tree.push_back(Node(currNode));
-        currEdge->child->index = currEdgeIndex;
-        currEdge->child->mark = currNode->mark;
-        currEdge->child->visits = 1;
-        currEdge->child->iters = 1;
-        currEdge->child->avgValue = currEdge->value;
-        currEdge->child->sumSquaredVals = currEdge->value*currEdge->value;
-      }
-
-      currNode = currEdge->child;
-    }
-
-    //Expand & Backpropagate new values
+  //Expands the leaf the board is at (or backpropagates its result if it is terminal) and backpropagates the new value along traversePath
+  auto processLeaf = [&](Node* currNode, Edge* currEdge, std::vector<std::pair<Edge*, U64>>& traversePath, int currDepth){
     if(currNode->isTerminal){
       tree.depth += currDepth;
       tree.root->visits += 1;
@@ -744,11 +1390,25 @@ inline void search(chess::Board& rootBoard, timeManagement tm, Tree& tree){
       currDepth++;
 
       //Make sure game isn't terminal
+      //If it is, the node is proven with the game's result, which is backpropagated right away since the node won't be selected again
+      //In graph mode any node can come to be shared, and a draw by repetition only holds on the path that got here.
+      //So such a node is neither terminal nor proven there, and it is checked again every time it is reached
       chess::MoveList moves(board);
-      if(chess::getGameStatus(board, moves.size()!=0) != chess::ONGOING){
+      chess::gameStatus status = chess::getGameStatus(board, history, moves.size()!=0);
+      if(status != chess::ONGOING){
         assert(currEdge->value>=-1);
-        currNode->isTerminal=true;
-        continue;
+        const bool pathDraw = tree.graph && status == chess::DRAW && chess::isRepetition(board, history);
+        currNode->isTerminal = !pathDraw;
+        currNode->proven = pathDraw ? chess::ONGOING : status;
+        tree.depth += currDepth;
+        tree.root->visits += 1;
+        tree.root->iters += 1;
+        backpropagate(tree, status, traversePath, 1, true, false, true);
+        currNode->avgValue = status;
+        currNode->sumSquaredVals = status * status;
+        if(!pathDraw){updateProven(currNode->parent);}
+        tree.seldepth = std::max(currDepth, int(tree.seldepth));
+        return;
       }
 
       //Create new child edges
@@ -759,26 +1419,75 @@ inline void search(chess::Board& rootBoard, timeManagement tm, Tree& tree){
 
       float currBestValue = 2;
 
-      nnue.refreshAccumulator(board);
-      std::array<std::array<int16_t, evaluation::NNUEhiddenNeurons>, 2> currAccumulator = nnue.accumulator;
+      //A position LRU pruned before gets its children's values back from the expansion cache, instead of a playout each
+      if(tree.expansionCache.restore(Tree::graphKey(board), parentNode->children)){
+        for(const Edge& edge : parentNode->children){currBestValue = std::min(currBestValue, edge.value);}
+      }
+      else{
+        nnue.refreshAccumulator(board);
+        std::array<std::array<int16_t, evaluation::NNUEhiddenNeurons>, 2> currAccumulator = nnue.accumulator;
+
+        //Compute the children's hashes up front, so the TT bucket of the next child can be loaded while this child is evaluated
+        for(int i=0; i<parentNode->children.size(); i++){
+          childHashes[i] = zobrist::updateHash(board, parentNode->children[i].edge);
+        }
+        tree.TT->prefetch(childHashes[0]);
 
-      for(int i=0; i<parentNode->children.size(); i++){
-        currEdge = &parentNode->children[i];
+        //With lazy expansion the children get a static eval first, and only the most promising ones get a full playout
+        const bool lazy = lazyExpansion && parentNode->children.size() > lazyExpansion;
+        for(int i=0; i<parentNode->children.size(); i++){
+          currEdge = &parentNode->children[i];
+          if(i + 1 < parentNode->children.size()){tree.TT->prefetch(childHashes[i+1]);}
 
-        chess::Board movedBoard = board;
+          nnue.accumulator = currAccumulator;
+          nnue.updateAccumulator(board, currEdge->edge);
+          chess::UndoInfo undo = chess::makeMove(board, history, currEdge->edge, childHashes[i]);
 
-        nnue.accumulator = currAccumulator;
-        nnue.updateAccumulator(movedBoard, currEdge->edge);
+          currEdge->value = lazy ? staticValue(tree, board, nnue) : playout(tree, board, history, nnue);
 
-        currEdge->value = playout(tree, movedBoard, nnue);
-        assert(-1<=currEdge->value && 1>=currEdge->value);
-        
-        currBestValue = std::min(currBestValue, currEdge->value);
+          chess::unmakeMove(board, history, currEdge->edge, undo);
+          assert(-1<=currEdge->value && 1>=currEdge->value);
+      
+          currBestValue = std::min(currBestValue, currEdge->value);
+        }
+
+        if(lazy){
+          std::array<uint8_t, 256> order; // NOLINT(cppcoreguidelines-pro-type-member-init)
+          std::iota(order.begin(), order.begin() + parentNode->children.size(), 0);
+          std::partial_sort(order.begin(), order.begin() + lazyExpansion, order.begin() + parentNode->children.size(), [&](uint8_t a, uint8_t b){
+            return parentNode->children[a].value < parentNode->children[b].value;
+          });
+          //The child which was best when the position was last in the tree gets a playout too, even if its static eval isn't among the best
+          if(warmStart){
+            TTEntry entry = tree.TT->probe(board.hash);
+            if(entry.val != TTEntry::EMPTY && entry.bestChild() && entry.bestChild() <= parentNode->children.size()){
+              auto end = order.begin() + parentNode->children.size();
+              auto hinted = std::find(order.begin() + lazyExpansion, end, entry.bestChild() - 1);
+              if(hinted != end){std::swap(*hinted, order[lazyExpansion - 1]);}
+            }
+          }
+
+          currBestValue = 2;
+          for(int i=0; i<lazyExpansion; i++){
+            currEdge = &parentNode->children[order[i]];
+            nnue.accumulator = currAccumulator;
+            nnue.updateAccumulator(board, currEdge->edge);
+            chess::UndoInfo undo = chess::makeMove(board, history, currEdge->edge, childHashes[order[i]]);
+
+            currEdge->value = playout(tree, board, history, nnue);
+
+            chess::unmakeMove(board, history, currEdge->edge, undo);
+            currBestValue = std::min(currBestValue, currEdge->value);
+          }
+          for(int i=lazyExpansion; i<parentNode->children.size(); i++){
+            parentNode->children[order[i]].value += Edge::PENDING;
+          }
+        }
       }
 
       int visits = 0;
       for(int i=0; i<parentNode->children.size(); i++){
-        if(parentNode->children[i].value <= currBestValue + Aurora::visitWindow.value){
+        if(parentNode->children[i].value <= currBestValue + tree.params.visitWindow){
           visits++;
         }
       }
@@ -792,9 +1501,139 @@ inline void search(chess::Board& rootBoard, timeManagement tm, Tree& tree){
 
       //Backpropagate best value
       backpropagate(tree, -currBestValue, traversePath, visits, true, false, true);
+      updateProven(parentNode);
     }
 
     tree.seldepth = std::max(currDepth, int(tree.seldepth));
+  };
+
+  while((tm.tmType == FOREVER) ||
+        (tm.tmType == TIME &&
+          ((tm.useSoftHardNodeLimits && elapsed.count()<std::min(tm.limit*bestMoveChangesMultiplier, tm.hardLimit)) ||
+          (!tm.useSoftHardNodeLimits && elapsed.count()<tm.limit))
+        ) ||
+        (tm.tmType == NODES &&
+          ((tm.useSoftHardNodeLimits && (tree.root->visits - tree.startNodes) < std::min(tm.limit*bestMoveChangesMultiplier, tm.hardLimit)) ||
+          (!tm.useSoftHardNodeLimits && (tree.root->visits - tree.startNodes) < tm.limit))
+        ) ||
+        (tm.tmType == ITERS &&
+          ((tm.useSoftHardNodeLimits && tree.root->iters < std::min(tm.limit*bestMoveChangesMultiplier, tm.hardLimit)) ||
+          (!tm.useSoftHardNodeLimits && tree.root->iters < tm.limit))
+        )
+      ){
+    //Once the root is proven, more visits can't change the best move
+    if(tree.root->proven != chess::ONGOING && !keepSearchingProvenRoot(tree.root, tm)){break;}
+
+    //board is returned to the root position at the end of every iteration by unmaking the moves in movePath
+    int currDepth = 0;
+    currNode = tree.root; tree.moveToHead(tree.root);
+    Edge* currEdge = nullptr;
+    bool reproven = false;
+    traversePath.clear();
+
+    //Traverse the search tree
+    while(currNode->children.size() > 0){
+      currDepth++;
+    
+      //The children are scattered around the tree, so start loading all of them before moving them in the LRU list and reading their stats in selectEdge
+      for(int i=0; i<currNode->children.size(); i++){
+        if(currNode->children[i].child != nullptr){
+          __builtin_prefetch(currNode->children[i].child);
+        }
+      }
+
+      //Move all children nodes to the front of LRU, and gather their stats for selectEdge on the way
+      childStats.size = currNode->children.size();
+      int provenChildren = 0;
+      bool lostChild = false;
+      for(int i=0; i<currNode->children.size(); i++){
+        if(currNode->children[i].child != nullptr){
+          tree.moveToHead(currNode->children[i].child);
+        }
+        chess::gameStatus childResult = childStats.set(i, currNode->children[i]);
+        provenChildren += childResult != chess::ONGOING;
+        lostChild |= childResult == chess::LOSS;
+      }
+
+      //In graph mode a child can be proven through another of its parents, and updateProven only walks up to the first one
+      //This parent finds out here, and the descent is dropped. At the root that ends the search, unless it goes on looking for a quicker mate
+      if(lostChild || provenChildren == currNode->children.size()){
+        updateProven(currNode);
+        if(currNode != tree.root || !keepSearchingProvenRoot(tree.root, tm)){
+          reproven = true;
+          break;
+        }
+      }
+
+      //Select Child Node to explore
+      uint8_t currEdgeIndex = selectEdge(currNode, childStats, currNode == tree.root, tree.params);
+
+      currEdge = &currNode->children[currEdgeIndex];
+      //the child's edges are what we will need next, load them while making the move
+      if(currEdge->child != nullptr && !currEdge->child->children.empty()){
+        __builtin_prefetch(currEdge->child->children.data());
+      }
+      undoPath.push_back(chess::makeMove(board, history, currEdge->edge));
+      movePath.push_back(currEdge->edge);
+      traversePath.push_back({currEdge, board.hash});
+
+      //In graph mode, a transposition links to the node its position already has, sharing its stats and subtree
+      //Nodes of finished games aren't shared. A draw by repetition depends on the path, so in graph mode it is never one (see processLeaf).
+      //The stats a shared node gets from below can still come from lines which repeat a position of only one of its parents' paths
+      U64 graphKey = 0;
+      if(currEdge->child == nullptr){
+        graphKey = Tree::graphKey(board);
+        if(tree.graph){
+          auto it = tree.nodeMap.find(graphKey);
+          if(it != tree.nodeMap.end() && !it->second->isTerminal){
+            Node* shared = it->second;
+            if(shared->parent){
+              shared->extraParents++;
+              tree.hasSharedNodes = true;
+            }
+            else{
+              shared->parent = currNode;
+              shared->index = currEdgeIndex;
+            }
+            currEdge->child = shared;
+            tree.moveToHead(shared);
+          }
+        }
+      }
+      //A shared node whose parent was evicted takes this one as its parent instead
+      else if(currEdge->child->parent == nullptr){
+        currEdge->child->parent = currNode;
+        currEdge->child->index = currEdgeIndex;
+        currEdge->child->extraParents--;
+      }
+
+      //If we only had a child edge before, create the corresponding child node
+      if(currEdge->child == nullptr){
+        currEdge->child = tree.push_back(Node(currNode));
+        currEdge->child->index = currEdgeIndex;
+        currEdge->child->mark = currNode->mark;
+        currEdge->child->visits = 1;
+        currEdge->child->iters = 1;
+        currEdge->child->avgValue = currEdge->selectionValue();
+        currEdge->child->sumSquaredVals = currEdge->child->avgValue*currEdge->child->avgValue;
+        currEdge->child->graphKey = graphKey;
+        //A position the tree had before (its entry has visits) starts with about the iterations it had, so its average moves as slowly as it did then
+        if(warmStart){
+          TTEntry entry = tree.TT->probe(board.hash);
+          if(entry.val != TTEntry::EMPTY && entry.visits > 1){currEdge->child->iters = (1 << std::min<int>(entry.visits, 16)) - 1;}
+        }
+        if(tree.graph){
+          auto [it, inserted] = tree.nodeMap.insert_or_assign(graphKey, currEdge->child);
+          tree.currSize += inserted ? Tree::NODE_MAP_ENTRY_SIZE : 0;
+        }
+      }
+
+      currNode = currEdge->child;
+    }
+
+    if(!reproven){processLeaf(currNode, currEdge, traversePath, currDepth);}
+    unmakePath(board, history, movePath, undoPath);
+    tree.flushTTWrites();
 
     //Output some information on the search occasionally
     elapsed = std::chrono::steady_clock::now() - start;
@@ -811,15 +1650,15 @@ inline void search(chess::Board& rootBoard, timeManagement tm, Tree& tree){
       }
 
     double expectedBestMoveChanges =
-      Aurora::bestMoveChangesCoefficient.value *
-      (std::pow(tree.root->visits, Aurora::bestMoveChangesExponent.value) -
-       std::pow(tree.startNodes, Aurora::bestMoveChangesExponent.value));
+      tree.params.bestMoveChangesCoefficient *
+      (std::pow(tree.root->visits, tree.params.bestMoveChangesExponent) -
+       std::pow(tree.startNodes, tree.params.bestMoveChangesExponent));
     const double bestMoveChangesMultiplierMin =
-      std::min(double(Aurora::bestMoveChangesMultiplierMin.value),
-              double(Aurora::bestMoveChangesMultiplierMax.value));
+      std::min(double(tree.params.bestMoveChangesMultiplierMin),
+              double(tree.params.bestMoveChangesMultiplierMax));
     const double bestMoveChangesMultiplierMax =
-      std::max(double(Aurora::bestMoveChangesMultiplierMin.value),
-              double(Aurora::bestMoveChangesMultiplierMax.value));
+      std::max(double(tree.params.bestMoveChangesMultiplierMin),
+              double(tree.params.bestMoveChangesMultiplierMax));
     bestMoveChangesMultiplier =
       std::clamp(bestMoveChanges / expectedBestMoveChanges,
                 bestMoveChangesMultiplierMin,
@@ -829,22 +1668,28 @@ inline void search(chess::Board& rootBoard, timeManagement tm, Tree& tree){
 
   //Output the final result of the search
   printSearchInfo(tree, start, true);
+  if(Aurora::outputLevel.value >= 1 && !tree.expansionCache.slots.empty()){
+    const ExpansionCache::Stats& stats = tree.expansionCache.stats;
+    std::cout << "info string expansion cache hits " << stats.hits << " of " << stats.probes << " expansions ("
+              << std::round(100.0 * stats.hits / std::max<uint64_t>(1, stats.probes)) << "%), " << stats.restoredEdges << " playouts saved, "
+              << stats.stores << " pruned nodes stored" << std::endl;
+  }
   if(Aurora::outputLevel.value >= 0){
     std::cout << "\nbestmove " << findBestAEdge(tree.root).edge.toStringRep() << std::endl; //std::endl to flush
   }
 }
 
 //Same as chess::makeMove except we move the root so we can keep nodes from an earlier search
-//Parameter "board" must be different than parameter "rootBoard"
-inline void makeMove(chess::Board& board, chess::Move move, chess::Board& rootBoard, Tree& tree){
+//Parameter "board" must be different than parameter "rootBoard", and the same goes for the histories
+inline void makeMove(chess::Board& board, chess::History& history, chess::Move move, chess::Board& rootBoard, chess::History& rootHistory, Tree& tree){
   if(tree.root == nullptr ||
-    board.equivalentHistory(rootBoard) == false
+    chess::equivalentHistory(board, history, rootBoard, rootHistory) == false
   ){
-      chess::makeMove(board, move);
+      chess::makeMove(board, history, move);
       return;
   }
 
-  chess::makeMove(board, move);
+  chess::makeMove(board, history, move);
 
   Edge newRootEdge = Edge(chess::Move());
   for(int i=0; i<tree.root->children.size(); i++){
@@ -863,7 +1708,7 @@ inline void makeMove(chess::Board& board, chess::Move move, chess::Board& rootBo
   tree.root->visits--;//Visits needs to be subtracted by 1 to remove the visit which added the node
   tree.root->iters--;//Same logic for iters
 
-  chess::makeMove(rootBoard, move);
+  chess::makeMove(rootBoard, rootHistory, move);
 }
 
 }//namespace search
\ No newline at end of file
@@ -0,0 +1,264 @@
+#pragma once
+//Saving and loading the search tree and TT, so a long analysis can be resumed after a restart instead of searched again
+//A snapshot is a header followed by fixed size records (nodes, then edges, then the TT's buckets), so it can also be memory mapped and read in place
+#include "search.h"
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace snapshot{
+
+constexpr char MAGIC[8] = {'A', 'U', 'R', 'S', 'N', 'A', 'P', '\0'};
+constexpr uint32_t VERSION = 3;
+constexpr uint64_t NONE = UINT64_MAX; //index of a missing parent or child
+
+struct Header{
+  char magic[8];
+  uint32_t version;
+  uint32_t ttGeneration;
+  uint64_t networkHash;
+  uint64_t numNodes;
+  uint64_t numEdges;
+  uint64_t numTTBuckets;
+  uint64_t rootIndex;
+  char fen[128]; //of the root position, null terminated
+};
+
+//Nodes are stored in LRU order, least recently used first, and refer to each other by their index in that order
+struct NodeRecord{
+  uint64_t parent;
+  uint32_t numChildren;
+  uint32_t visits;
+  int32_t iters;
+  float avgValue;
+  float sumSquaredVals;
+  uint8_t isTerminal;
+  uint8_t index;
+  int8_t proven;
+  uint8_t padding1 = 0;
+  uint16_t provenPlies;
+  uint8_t padding2[6] = {};
+};
+
+//Edges are stored in the order of the nodes they belong to
+struct EdgeRecord{
+  uint64_t child;
+  float value;
+  uint16_t move;
+  uint8_t padding[2] = {};
+};
+
+static_assert(sizeof(Header) == 184);
+static_assert(sizeof(NodeRecord) == 40);
+static_assert(sizeof(EdgeRecord) == 16);
+
+//Records are written and read in batches of this many
+constexpr size_t BATCH_SIZE = 65536;
+
+//Returns false (after printing why) if the snapshot couldn't be written
+inline bool saveTree(search::Tree& tree, const chess::Board& rootBoard, const std::string& path){
+  if(!tree.root){
+    std::cout << "info string there is no tree to save" << std::endl;
+    return false;
+  }
+  std::ofstream file(path, std::ios::binary);
+  if(!file){
+    std::cout << "info string could not open " << path << std::endl;
+    return false;
+  }
+
+  Header header = {};
+  std::copy(std::begin(MAGIC), std::end(MAGIC), header.magic);
+  header.version = VERSION;
+  header.ttGeneration = tree.TT->generation.load(std::memory_order_relaxed);
+  header.networkHash = evaluation::networkHash();
+  header.numTTBuckets = tree.TT->size();
+  std::string fen = rootBoard.getFen();
+  fen.copy(header.fen, sizeof(header.fen) - 1);
+
+  //snapshotIndex overwrites graphKey, which is put back once the snapshot is written
+  std::vector<U64> keys;
+  for(search::Node* node = tree.tail; node; node = node->forwardLink){
+    keys.push_back(node->graphKey);
+    node->snapshotIndex = header.numNodes++;
+    header.numEdges += node->children.size();
+  }
+  header.rootIndex = tree.root->snapshotIndex;
+  file.write(reinterpret_cast<const char*>(&header), sizeof(Header));
+
+  std::vector<NodeRecord> nodeRecords;
+  nodeRecords.reserve(BATCH_SIZE);
+  for(search::Node* node = tree.tail; node; node = node->forwardLink){
+    nodeRecords.push_back({
+      node->parent ? node->parent->snapshotIndex : NONE, uint32_t(node->children.size()),
+      node->visits, node->iters, node->avgValue, node->sumSquaredVals, node->isTerminal, node->index, node->proven, 0, node->provenPlies
+    });
+    if(nodeRecords.size() == BATCH_SIZE || !node->forwardLink){
+      file.write(reinterpret_cast<const char*>(nodeRecords.data()), nodeRecords.size() * sizeof(NodeRecord));
+      nodeRecords.clear();
+    }
+  }
+
+  std::vector<EdgeRecord> edgeRecords;
+  edgeRecords.reserve(BATCH_SIZE);
+  for(search::Node* node = tree.tail; node; node = node->forwardLink){
+    for(const search::Edge& edge : node->children){
+      edgeRecords.push_back({edge.child ? edge.child->snapshotIndex : NONE, edge.value, edge.edge.value});
+    }
+    if(edgeRecords.size() >= BATCH_SIZE || !node->forwardLink){
+      file.write(reinterpret_cast<const char*>(edgeRecords.data()), edgeRecords.size() * sizeof(EdgeRecord));
+      edgeRecords.clear();
+    }
+  }
+
+  std::vector<uint64_t> words;
+  words.reserve(BATCH_SIZE * search::TTBucket::size);
+  for(size_t i=0; i<tree.TT->size(); i++){
+    for(int j=0; j<search::TTBucket::size; j++){
+      words.push_back(tree.TT->buckets[i].entries[j].load(std::memory_order_relaxed));
+    }
+    if(words.size() >= BATCH_SIZE * search::TTBucket::size || i + 1 == tree.TT->size()){
+      file.write(reinterpret_cast<const char*>(words.data()), words.size() * sizeof(uint64_t));
+      words.clear();
+    }
+  }
+
+  size_t keyIndex = 0;
+  for(search::Node* node = tree.tail; node; node = node->forwardLink){node->graphKey = keys[keyIndex++];}
+
+  if(!file){
+    std::cout << "info string could not write " << path << std::endl;
+    return false;
+  }
+  std::cout << "info string saved " << header.numNodes << " nodes and " << header.numTTBuckets * search::TTBucket::size << " TT entries to " << path << std::endl;
+  return true;
+}
+
+//Replaces the tree (and TT) with the snapshot, which has to be of board's position and made with the same network
+//Returns false (after printing why) if it couldn't be loaded, in which case the tree is left empty if it was already cleared
+inline bool loadTree(search::Tree& tree, const chess::Board& board, const std::string& path){
+  std::ifstream file(path, std::ios::binary);
+  if(!file){
+    std::cout << "info string could not open " << path << std::endl;
+    return false;
+  }
+  Header header;
+  if(!file.read(reinterpret_cast<char*>(&header), sizeof(Header)) || !std::equal(std::begin(MAGIC), std::end(MAGIC), header.magic) || header.version != VERSION){
+    std::cout << "info string " << path << " is not a tree snapshot of this version" << std::endl;
+    return false;
+  }
+  header.fen[sizeof(header.fen) - 1] = '\0';
+  if(header.networkHash != evaluation::networkHash()){
+    std::cout << "info string " << path << " was made with a different network" << std::endl;
+    return false;
+  }
+  if(std::string(header.fen) != board.getFen()){
+    std::cout << "info string " << path << " is a snapshot of " << header.fen << ", not the current position" << std::endl;
+    return false;
+  }
+  if(header.numNodes == 0 || header.rootIndex >= header.numNodes){
+    std::cout << "info string " << path << " has no root" << std::endl;
+    return false;
+  }
+  //The counts in the header size everything that is allocated below, so they have to add up to the file's size first
+  file.seekg(0, std::ios::end);
+  uint64_t remaining = uint64_t(file.tellg()) - sizeof(Header);
+  file.seekg(sizeof(Header));
+  auto take = [&](uint64_t count, uint64_t recordSize){
+    if(count > remaining / recordSize){return false;}
+    remaining -= count * recordSize;
+    return true;
+  };
+  if(!take(header.numNodes, sizeof(NodeRecord)) || !take(header.numEdges, sizeof(EdgeRecord)) ||
+     !take(header.numTTBuckets, search::TTBucket::size * sizeof(uint64_t)) || remaining != 0){
+    std::cout << "info string " << path << " is truncated or corrupt" << std::endl;
+    return false;
+  }
+  tree.setHash();
+  search::destroyTree(tree);
+  auto fail = [&](){
+    search::destroyTree(tree);
+    std::cout << "info string " << path << " is truncated or corrupt" << std::endl;
+    return false;
+  };
+
+  std::vector<NodeRecord> nodeRecords(header.numNodes);
+  if(!file.read(reinterpret_cast<char*>(nodeRecords.data()), header.numNodes * sizeof(NodeRecord))){return fail();}
+
+  //push_back() puts each node at the head of the LRU list, so adding them in the stored order restores it
+  //All of them are loaded even if they don't fit in Hash (push_back() would evict them before they are linked up), and the tree is shrunk afterwards
+  const uint64_t sizeLimit = tree.sizeLimit;
+  tree.sizeLimit = 0;
+  std::vector<search::Node*> nodes(header.numNodes);
+  for(uint64_t i=0; i<header.numNodes; i++){
+    nodes[i] = tree.push_back(search::Node());
+  }
+  tree.sizeLimit = sizeLimit;
+
+  std::vector<EdgeRecord> edgeRecords;
+  uint64_t numEdges = 0;
+  for(uint64_t i=0; i<header.numNodes; i++){
+    const NodeRecord& record = nodeRecords[i];
+    search::Node* node = nodes[i];
+    //evictTail writes to the parent's edge at index, so it has to be one of them
+    if(record.parent != NONE && (record.parent >= header.numNodes || record.index >= nodeRecords[record.parent].numChildren)){return fail();}
+    if(record.numChildren > header.numEdges - numEdges){return fail();}
+    numEdges += record.numChildren;
+    node->parent = record.parent == NONE ? nullptr : nodes[record.parent];
+    node->visits = record.visits;
+    node->iters = record.iters;
+    node->avgValue = record.avgValue;
+    node->sumSquaredVals = record.sumSquaredVals;
+    node->isTerminal = record.isTerminal;
+    node->index = record.index;
+    node->proven = chess::gameStatus(record.proven);
+    node->provenPlies = record.provenPlies;
+
+    edgeRecords.resize(record.numChildren);
+    if(!file.read(reinterpret_cast<char*>(edgeRecords.data()), record.numChildren * sizeof(EdgeRecord))){return fail();}
+    node->children.reserve(record.numChildren);
+    for(const EdgeRecord& edgeRecord : edgeRecords){
+      if(edgeRecord.child != NONE && edgeRecord.child >= header.numNodes){return fail();}
+      search::Edge edge;
+      edge.child = edgeRecord.child == NONE ? nullptr : nodes[edgeRecord.child];
+      edge.value = edgeRecord.value;
+      edge.edge.value = edgeRecord.move;
+      node->children.push_back(edge);
+    }
+    tree.currSize += record.numChildren * sizeof(search::Edge);
+  }
+  if(numEdges != header.numEdges){return fail();}
+  tree.root = nodes[header.rootIndex];
+  //A snapshot made in graph mode has nodes with several parents. They are shared as before, but aren't in nodeMap, so new transpositions don't find them
+  //Loaded nodes don't know their graphKey either, so they aren't kept in the expansion cache when LRU prunes them
+  search::relinkParents(tree);
+  tree.hasSharedNodes = std::any_of(tree.tree.begin(), tree.tree.end(), [](const search::Node& node){return node.extraParents > 0;});
+  tree.shrink();
+
+  //The TT is loaded at the size it was saved with, then resized to the current one which carries the entries over.
+  //A TT shared with other Trees is left alone, since they don't search this position
+  if(tree.TT.use_count() == 1 && header.numTTBuckets){
+    const size_t currBuckets = tree.TT->size();
+    tree.TT->release();
+    tree.TT->resize(header.numTTBuckets);
+    std::vector<uint64_t> words(BATCH_SIZE * search::TTBucket::size);
+    for(size_t i=0; i<header.numTTBuckets; i+=BATCH_SIZE){
+      const size_t numBuckets = std::min<size_t>(BATCH_SIZE, header.numTTBuckets - i);
+      if(!file.read(reinterpret_cast<char*>(words.data()), numBuckets * search::TTBucket::size * sizeof(uint64_t))){
+        tree.TT->resize(currBuckets);
+        tree.TT->clear();
+        return fail();
+      }
+      for(size_t j=0; j<numBuckets * search::TTBucket::size; j++){
+        tree.TT->buckets[i + j / search::TTBucket::size].entries[j % search::TTBucket::size].store(words[j], std::memory_order_relaxed);
+      }
+    }
+    tree.TT->generation = header.ttGeneration;
+    tree.TT->resize(currBuckets);
+  }
+
+  std::cout << "info string loaded " << header.numNodes << " nodes with " << tree.root->visits << " visits at the root from " << path << std::endl;
+  return true;
+}
+
+}
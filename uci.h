@@ -2,26 +2,20 @@
 //Start reading code relating to move generation/chess rules in "bitboards.h"
 //After reading this file, go to files relating to search, starting with "search.h"
 #include "search.h"
+#include "snapshot.h"
 #include <chrono>
 //See https://backscattering.de/chess/uci/ for information on the Universal Chess Interface, which this file implements
 namespace uci{
 
 inline search::Node* root;
 inline chess::Board rootBoard;
+inline chess::History rootHistory;
 inline search::Tree tree;
 
-inline void ensureBoardHashed(chess::Board& board){
-  if(board.hashed){
-    return;
-  }
-  board.history[board.halfmoveClock] = zobrist::getHash(board);
-  board.hashed = true;
-}
-
-inline void syncTreeWithBoardHistory(chess::Board& board){
-  ensureBoardHashed(board);
-  ensureBoardHashed(rootBoard);
-  if(!board.equivalentHistory(rootBoard)){
+inline void syncTreeWithBoardHistory(chess::Board& board, chess::History& history){
+  chess::ensureHashed(board, history);
+  chess::ensureHashed(rootBoard, rootHistory);
+  if(!chess::equivalentHistory(board, history, rootBoard, rootHistory)){
     search::destroyTree(tree);
     root = nullptr;
   }
@@ -63,13 +57,18 @@ inline void bench(){
   Aurora::outputLevel.value = -1;
 
   float totalElapsed = 0;
+  evaluation::QSearchStats qSearchStats;
+  search::Tree::TTWriteStats ttWriteStats;
+  search::ExpansionCache::Stats expansionCacheStats;
 
   for(const std::string& fen : benchFens){
     chess::Board board(fen);
+    chess::History history;
+    tree.qsTT.stats = evaluation::QSearchStats();
 
     auto start = std::chrono::steady_clock::now();
 
-    search::search(board, search::timeManagement(search::ITERS, 10000), tree);
+    search::search(board, history, search::timeManagement(search::ITERS, 10000), tree);
 
     std::chrono::duration<float> elapsed = std::chrono::steady_clock::now() - start;
     totalElapsed += elapsed.count();
@@ -77,11 +76,34 @@ inline void bench(){
     search::Node* root = tree.root;
 
     nodes += root->visits;
+    qSearchStats.nodes += tree.qsTT.stats.nodes;
+    qSearchStats.ttHits += tree.qsTT.stats.ttHits;
+    qSearchStats.deltaPrunes += tree.qsTT.stats.deltaPrunes;
+    qSearchStats.leaves += tree.qsTT.stats.leaves;
+    qSearchStats.maxLeafNodes = std::max(qSearchStats.maxLeafNodes, tree.qsTT.stats.maxLeafNodes);
+    ttWriteStats.writes += tree.ttWriteStats.writes;
+    ttWriteStats.skipped += tree.ttWriteStats.skipped;
+    expansionCacheStats.stores += tree.expansionCache.stats.stores;
+    expansionCacheStats.probes += tree.expansionCache.stats.probes;
+    expansionCacheStats.hits += tree.expansionCache.stats.hits;
+    expansionCacheStats.restoredEdges += tree.expansionCache.stats.restoredEdges;
 
     search::destroyTree(tree); root = nullptr;
   }
 
 
+  //To compare qSearch node counts, run bench after changing QSearchTTHash (0 turns off the qSearch TT), 
+  //qSearchDeltaMargin (its max effectively turns off delta pruning) or qSearchMaxDepth with setoption
+  std::cout << "\nqsearch nodes " << qSearchStats.nodes << " (" << float(qSearchStats.nodes) / std::max<uint64_t>(1, qSearchStats.leaves) << " per leaf, max " << qSearchStats.maxLeafNodes << ")"
+            << " tt hits " << qSearchStats.ttHits << " delta prunes " << qSearchStats.deltaPrunes
+            << " (QSearchTTHash " << Aurora::qSearchTTHash.value << " qSearchDeltaMargin " << Aurora::qSearchDeltaMargin.value << " qSearchMaxDepth " << Aurora::qSearchMaxDepth.value << ")";
+  std::cout << "\ntt write-back " << ttWriteStats.writes << " writes, " << ttWriteStats.skipped << " skipped ("
+            << std::round(100.0 * ttWriteStats.skipped / std::max<uint64_t>(1, ttWriteStats.writes)) << "%)";
+  //The expansion cache only gets entries once the tree is full, so run bench with a small Hash and a nonzero ExpansionCacheHash to measure it
+  std::cout << "\nexpansion cache hits " << expansionCacheStats.hits << " of " << expansionCacheStats.probes << " expansions ("
+            << std::round(100.0 * expansionCacheStats.hits / std::max<uint64_t>(1, expansionCacheStats.probes)) << "%), "
+            << expansionCacheStats.restoredEdges << " playouts saved, " << expansionCacheStats.stores << " pruned nodes stored"
+            << " (Hash " << Aurora::hash.value << " ExpansionCacheHash " << Aurora::expansionCacheHash.value << ")";
   std::cout << "\n" << nodes << " nodes " << int(nodes/totalElapsed) << " nps" << std::endl;
 }
 
@@ -106,15 +128,16 @@ inline chess::Move getMoveFromString(chess::Board &board, std::string token){
   return move;
 }
 
-inline chess::Board makeMoves(chess::Board &board, std::istringstream& input){
+inline chess::Board makeMoves(chess::Board &board, chess::History& history, std::istringstream& input){
   std::string token;
   while(input >> token){
-    search::makeMove(board, getMoveFromString(board, token), rootBoard, tree);
+    search::makeMove(board, history, getMoveFromString(board, token), rootBoard, rootHistory, tree);
   }
   return board;
 }
 
-inline chess::Board position(std::istringstream& input){
+//Also resets history to the history of the new position
+inline chess::Board position(std::istringstream& input, chess::History& history){
   std::string fen = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1";
   std::string token;
 
@@ -133,9 +156,10 @@ inline chess::Board position(std::istringstream& input){
 
   chess::Board board(fen);
 
-  ensureBoardHashed(board);
+  history.clear();
+  chess::ensureHashed(board, history);
 
-  makeMoves(board, input);
+  makeMoves(board, history, input);
 
   std::cout << "info string position set to " << board.getFen() << std::endl;
 
@@ -154,10 +178,10 @@ inline uint64_t perft(chess::Board &board, int depth, bool printResults){
   }
 
   for(chess::Move move : chess::MoveList(board)){
-    chess::Board movedBoard = board;
-    movedBoard.makeMove(move);
+    chess::UndoInfo undo = board.makeMove(move);
 
-    uint64_t result = perft(movedBoard, depth-1, false);
+    uint64_t result = perft(board, depth-1, false);
+    board.unmakeMove(move, undo);
     if(printResults){std::cout << move.toStringRep() << ": " << result << "\n";}
     nodes += result;
   }
@@ -166,7 +190,6 @@ inline uint64_t perft(chess::Board &board, int depth, bool printResults){
 }
 
 inline uint64_t perftDiv(chess::Board &board, int depth){
-  chess::Board movedBoard;
   uint64_t nodes = 0;
 
   auto start = std::chrono::steady_clock::now();
@@ -184,31 +207,64 @@ inline uint64_t perftDiv(chess::Board &board, int depth){
   return nodes;
 }
 
-inline void go(std::istringstream& input, chess::Board board){
+//perft positions and depths used by perftBench(), from https://www.chessprogramming.org/Perft_Results
+const int AMOUNT_OF_PERFT_FENS = 5;
+
+inline const std::pair<std::string, int> perftBenchFens[AMOUNT_OF_PERFT_FENS] = {
+      {"rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1", 6},
+      {"r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1", 5},
+      {"8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1", 6},
+      {"r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1", 5},
+      {"rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8", 5},
+};
+
+//Move generation benchmark
+inline void perftBench(){
+  uint64_t nodes = 0;
+  double totalElapsed = 0;
+
+  for(const auto& [fen, depth] : perftBenchFens){
+    chess::Board board(fen);
+
+    auto start = std::chrono::steady_clock::now();
+    nodes += perft(board, depth, false);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    totalElapsed += elapsed.count();
+  }
+
+  std::cout << "\n" << nodes << " nodes " << uint64_t(nodes/totalElapsed) << " nps" << std::endl;
+}
+
+inline void go(std::istringstream& input, chess::Board& board, chess::History& history){
   std::string token;
 
   input >> token;
-  syncTreeWithBoardHistory(board);
+  syncTreeWithBoardHistory(board, history);
 
   if(token == "infinite"){
-    search::search(board, search::timeManagement(search::FOREVER), tree);
+    search::search(board, history, search::timeManagement(search::FOREVER), tree);
+  }
+  else if(token == "mate"){
+    search::timeManagement tm(search::FOREVER);
+    input >> tm.mate;
+    search::search(board, history, tm, tree);
   }
   else if(token == "nodes"){
     int maxNodes = 0;
     input >> maxNodes;
-    search::search(board, search::timeManagement(search::NODES, maxNodes), tree);
+    search::search(board, history, search::timeManagement(search::NODES, maxNodes), tree);
   }
   else if(token == "iters"){
     int maxIters = 0;
     input >> maxIters;
-    search::search(board, search::timeManagement(search::ITERS, maxIters), tree);
+    search::search(board, history, search::timeManagement(search::ITERS, maxIters), tree);
   }
   else if(token == "movetime"){
     int time = 0;
     input >> time;
     search::timeManagement limit = search::timeManagement(search::TIME, 1000000000.0);
     limit.limit = time/1000.0;
-    search::search(board, limit, tree); 
+    search::search(board, history, limit, tree); 
   }
   else{
     search::timeManagement tm;
@@ -259,12 +315,21 @@ inline void go(std::istringstream& input, chess::Board board){
       float(std::max(ourTime-50, 1))
     );
     tm.hardLimit = useNodeTime ? 30000.0*allocatedTime/1000.0 : allocatedTime/1000.0;
-    search::search(board, tm, tree);
+    search::search(board, history, tm, tree);
   }
   rootBoard = board;
+  rootHistory = history;
   root = tree.root;
 }
 
+//Spin options are printed as integers, since a float would switch to scientific notation for big values like Hash's max
+inline std::string spinValue(const Aurora::Option& option, float value){
+  std::ostringstream output;
+  if(option.type == 1){output << int64_t(value);}
+  else{output << value;}
+  return output.str();
+}
+
 inline void respondUci(){
   std::cout <<  "id name Aurora " << VERSION_NUM DEV_STRING << "\n"
                 "id author kjljixx\n"
@@ -283,9 +348,9 @@ inline void respondUci(){
                   else{
                     std::cout << "option name " << option->name << " "
                                         "type " << (option->type == 1 ? "spin" : "string") << " "
-                                        "default " << option->defaultValue << " "
-                                        "min " << option->minValue << " "
-                                        "max " << option->maxValue << "\n";
+                                        "default " << spinValue(*option, option->defaultValue) << " "
+                                        "min " << spinValue(*option, option->minValue) << " "
+                                        "max " << spinValue(*option, option->maxValue) << "\n";
                   }
                 }
                 std::cout << "\nuciok" << std::endl;
@@ -321,30 +386,36 @@ inline void setOption(std::istringstream& input){
     float optionValue = 0;
     input >> optionValue;
     Aurora::getOption(optionName)->value = optionValue;
-    std::cout << "info string option " << optionName << " set to " << optionValue << std::endl;
+    //(re)allocate now rather than in the first go, isready waits for this since the uci loop is single threaded
+    if(optionName == "Hash" || optionName == "TTHash" || optionName == "QSearchTTHash"){tree.setHash();}
+    std::cout << "info string option " << optionName << " set to " << spinValue(*Aurora::getOption(optionName), optionValue) << std::endl;
   }
 }
 
 //The main UCI loop which detects input and runs other functions based on it
 inline void loop(chess::Board board){
   std::string token;
+  chess::History history;
 
   while(true){
     std::cin >> token;
     if(token == "uci"){respondUci();}
     if(token == "build"){std::cout << GIT_HASH_STRING << std::endl;}
     if(token == "setoption"){std::getline(std::cin, token); auto stream = std::istringstream(token); setOption(stream);}
-    if(token == "isready"){std::cout << "readyok" << std::endl;} //TODO: make sure we are actually ready before printing readyok
+    if(token == "isready"){tree.setHash(); std::cout << "readyok" << std::endl;}
     if(token == "perft"){int depth = 0; std::cin >> depth; perftDiv(board, depth);}
-    if(token == "position"){std::getline(std::cin, token); auto stream = std::istringstream(token); board = position(stream);}
-    if(token == "go"){std::getline(std::cin, token); auto stream = std::istringstream(token); go(stream, board);}
+    if(token == "position"){std::getline(std::cin, token); auto stream = std::istringstream(token); board = position(stream, history);}
+    if(token == "go"){std::getline(std::cin, token); auto stream = std::istringstream(token); go(stream, board, history);}
     if(token == "quit"){break;}
     if(token == "ucinewgame"){search::destroyTree(tree); root = nullptr; std::cout << "info string search tree destroyed" << std::endl;}
     //non-uci, custom commands
-    if(token == "moves"){std::getline(std::cin, token); auto stream = std::istringstream(token); board = makeMoves(board, stream);}
+    if(token == "moves"){std::getline(std::cin, token); auto stream = std::istringstream(token); board = makeMoves(board, history, stream);}
+    //the tree belongs to the position of the last search (rootBoard), and is loaded for the current one
+    if(token == "savetree"){std::cin >> token; snapshot::saveTree(tree, rootBoard, token);}
+    if(token == "loadtree"){std::cin >> token; chess::ensureHashed(board, history); if(snapshot::loadTree(tree, board, token)){rootBoard = board; rootHistory = history; root = tree.root;}}
     //bwlow are mostly for debugging purposes
     if(token == "debug"){auto stream = std::istringstream("name outputLevel value 3"); setOption(stream);}
-    if(token == "fen"){std::getline(std::cin, token); auto stream = std::istringstream("fen " + token); board = position(stream);}
+    if(token == "fen"){std::getline(std::cin, token); auto stream = std::istringstream("fen " + token); board = position(stream, history);}
 
     if(token == "board"){board.printBoard(); std::cout << std::endl;}
 
@@ -354,11 +425,12 @@ inline void loop(chess::Board board){
     if(token == "bpinmask"){bitboards::printBoard(board.generateKingMasks().bishopPinmask); std::cout << std::endl;}
     if(token == "bpinned"){bitboards::printBoard(board.generateKingMasks().bishopPinnedPieces); std::cout << std::endl;}
     
-    if(token == "staticeval"){evaluation::NNUE<evaluation::NNUEhiddenNeurons> nnue(evaluation::nnueParameters); nnue.refreshAccumulator(board); std::cout << evaluation::evaluate(board, nnue) << std::endl;}
-    if(token == "see"){std::cin >> token; uint8_t square = squareNotationToIndex(token); std::cout << evaluation::SEE(board, square, 0) << std::endl;}
+    if(token == "staticeval"){evaluation::NNUE<evaluation::NNUEhiddenNeurons> nnue(evaluation::nnueParameters); nnue.refreshAccumulator(board); chess::ensureHashed(board, history); evaluation::QSearchTT qsTT; std::cout << evaluation::evaluate(board, history, nnue, qsTT, evaluation::QSearchParams::fromOptions()) << std::endl;}
+    if(token == "see"){std::cin >> token; uint8_t square = squareNotationToIndex(token); std::cout << evaluation::SEE(board, square) << std::endl;}
     
     if(token == "zobrist"){std::cout << zobrist::getHash(board) << std::endl;}
     if(token == "bench"){bench();}
+    if(token == "perftbench"){perftBench();}
   }
 }
 }
\ No newline at end of file
@@ -63,7 +63,7 @@ inline U64 getHash(chess::Board& board){
   return hash;
 }
 inline U64 updateHash(chess::Board& board, chess::Move move){
-  U64 hash = board.history[board.halfmoveClock];
+  U64 hash = board.hash;
   const uint8_t startSquare = move.getStartSquare();
   const uint8_t endSquare = move.getEndSquare();
   const chess::Pieces movingPiece = board.findPiece(startSquare);
@@ -150,16 +150,38 @@ inline U64 updateHash(chess::Board& board, chess::Move move){
 }
 }//namespace
 namespace chess{
-  //The normal Board.makeMove except we update the zobrist hash. Use this rather than Board.makeMove for making moves during a game
-  inline void makeMove(chess::Board& board, chess::Move move){
-    if(!board.hashed){
-      // Seed history with the current position so repetition counting includes the root.
-      board.history[board.halfmoveClock] = zobrist::getHash(board);
-      board.hashed = true;
+  //Computes the zobrist hash of the board and puts the position on top of history, if that hasn't been done already
+  inline void ensureHashed(chess::Board& board, chess::History& history){
+    if(board.hashed){
+      return;
     }
+    board.hash = zobrist::getHash(board);
+    board.hashed = true;
+    history.push(board.hash);
+  }
+
+  //The normal Board.makeMove except we update the zobrist hash and history. Use this rather than Board.makeMove for making moves during a game or search
+  //newHash must be zobrist::updateHash(board, move) for the already hashed board
+  //This is for callers which needed the hash of the position after the move before making it
+  inline UndoInfo makeMove(chess::Board& board, chess::History& history, chess::Move move, U64 newHash){
+    assert(board.hashed && newHash == zobrist::updateHash(board, move));
+    UndoInfo undo = board.makeMove(move);
+    board.hash = newHash;
+    history.push(newHash);
+
+    return undo;
+  }
+
+  inline UndoInfo makeMove(chess::Board& board, chess::History& history, chess::Move move){
+    // Seed history with the current position so repetition counting includes the root.
+    ensureHashed(board, history);
+
+    return makeMove(board, history, move, zobrist::updateHash(board, move));
+  }
 
-    U64 newHash = zobrist::updateHash(board, move);
-    board.makeMove(move);
-    board.history[board.halfmoveClock] = newHash;
+  //Reverts a move made with chess::makeMove()
+  inline void unmakeMove(chess::Board& board, chess::History& history, chess::Move move, const UndoInfo& undo){
+    history.pop();
+    board.unmakeMove(move, undo);
   }
 }